@@ -0,0 +1,293 @@
+// Persistent analysis cache shared across runs. Results of finished searches
+// (minimax depth/score/move, MCTS visit statistics per column) are appended
+// to a log of fixed-size records; at startup the log is memory-mapped and
+// indexed, later records for a key superseding earlier ones. Records are
+// held in memory only until they are flushed; the mapping then grows over
+// them and the index points into it.
+//
+// File layout: a CacheHeader followed by CacheRecords. Keys are
+// BitBoard::canonicalKey() of the position, which encodes the stones of the
+// side to move and the occupied cells, so a key and its record are relative
+// to the side to move. Records are stored as seen from the canonical
+// orientation, so a position and its mirror image share one record.
+#ifndef CONNECT4_ANALYSIS_CACHE_H
+#define CONNECT4_ANALYSIS_CACHE_H
+
+#include "connect4_bitboard.h"
+
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <shared_mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Version 2: MCTS rewards are kept for the side that moved into the child,
+// the negative of version 1's, so older caches are refused
+const char CACHE_MAGIC[8] = {'C', '4', 'C', 'A', 'C', 'H', 'E', '2'};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t recordSize;
+    uint32_t reserved;
+};
+
+struct CacheRecord {
+    uint64_t key;
+    int32_t score;                      // minimax score for the side to move
+    uint8_t depth;                      // minimax depth, 0 = no minimax result
+    int8_t move;                        // minimax best move
+    uint16_t reserved;
+    uint32_t visits[BitBoard::WIDTH];   // MCTS visits per root child, all 0 = none
+    float rewards[BitBoard::WIDTH];     // MCTS total reward per root child
+};
+
+class AnalysisCache {
+public:
+    ~AnalysisCache() { close(); }
+
+    // Maps the existing log (creating it if missing) and opens it for appending
+    bool open(const char* path) {
+        close();
+        fd = ::open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close();
+            return false;
+        }
+        CacheHeader expected = {};
+        memcpy(expected.magic, CACHE_MAGIC, 8);
+        expected.width = BitBoard::WIDTH;
+        expected.height = BitBoard::HEIGHT;
+        expected.recordSize = sizeof(CacheRecord);
+        if (st.st_size == 0) {
+            if (write(fd, &expected, sizeof(expected)) != (ssize_t)sizeof(expected)) {
+                close();
+                return false;
+            }
+            return true;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED || (size_t)st.st_size < sizeof(CacheHeader) ||
+            memcmp(map, &expected, sizeof(expected)) != 0) {
+            if (map != MAP_FAILED) munmap(map, st.st_size);
+            close();
+            return false;
+        }
+        mapped = map;
+        mappedLength = st.st_size;
+        // A torn record at the end of the log from an interrupted flush is
+        // cut off, so that the records appended after it stay aligned
+        size_t count = (st.st_size - sizeof(CacheHeader)) / sizeof(CacheRecord);
+        size_t whole = sizeof(CacheHeader) + count * sizeof(CacheRecord);
+        if (whole != (size_t)st.st_size && ftruncate(fd, whole) != 0) {
+            close();
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t offset = sizeof(CacheHeader) + i * sizeof(CacheRecord);
+            index[recordAt(offset).key] = offset;
+        }
+        return true;
+    }
+
+    void close() {
+        if (fd >= 0) {
+            flush();
+            ::close(fd);
+        }
+        if (mapped) {
+            munmap(mapped, mappedLength);
+        }
+        fd = -1;
+        mapped = nullptr;
+        index.clear();
+        fresh.clear();
+        writtenAt.clear();
+        freshBase = 0;
+        appendFailed = false;
+    }
+
+    bool loaded() const { return fd >= 0; }
+
+    // Record for b, with moves and columns as seen from b
+    bool probe(const BitBoard& b, CacheRecord& record) {
+        bool mirrored;
+        uint64_t key = b.canonicalKey(mirrored);
+        {
+            std::shared_lock<std::shared_mutex> guard(lock);
+            auto it = index.find(key);
+            if (it == index.end()) {
+                return false;
+            }
+            record = lookup(it->second);
+        }
+        if (mirrored) {
+            mirrorRecord(record);
+        }
+        return true;
+    }
+
+    void storeSearch(const BitBoard& b, unsigned int depth, int score, int move) {
+        bool mirrored;
+        uint64_t key = b.canonicalKey(mirrored);
+        if (mirrored && move >= 0) {
+            move = BitBoard::WIDTH - 1 - move;
+        }
+        update(key, [&](CacheRecord& r) {
+            if (depth >= r.depth) {
+                r.depth = (uint8_t)depth;
+                r.score = score;
+                r.move = (int8_t)move;
+            }
+        });
+    }
+
+    void storeVisits(const BitBoard& b, const uint32_t* visits, const float* rewards) {
+        bool mirrored;
+        uint64_t key = b.canonicalKey(mirrored);
+        update(key, [&](CacheRecord& r) {
+            memcpy(r.visits, visits, sizeof(r.visits));
+            memcpy(r.rewards, rewards, sizeof(r.rewards));
+            if (mirrored) {
+                mirrorColumns(r);
+            }
+        });
+    }
+
+    // Appends records added since the last flush to the log
+    void flush() {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        flushLocked();
+    }
+
+private:
+    static void mirrorColumns(CacheRecord& r) {
+        for (int col = 0; col < BitBoard::WIDTH / 2; col++) {
+            std::swap(r.visits[col], r.visits[BitBoard::WIDTH - 1 - col]);
+            std::swap(r.rewards[col], r.rewards[BitBoard::WIDTH - 1 - col]);
+        }
+    }
+
+    static void mirrorRecord(CacheRecord& r) {
+        if (r.move >= 0 && r.depth > 0) {
+            r.move = (int8_t)(BitBoard::WIDTH - 1 - r.move);
+        }
+        mirrorColumns(r);
+    }
+
+    // New records are flushed in batches of this many
+    static const size_t FLUSH_BATCH = 64;
+    // Index values with this bit set are fresh records not yet in the file,
+    // numbered from the first ever added; others are file offsets
+    static const uint64_t PENDING = 1ULL << 63;
+
+    const CacheRecord& recordAt(uint64_t offset) const {
+        return *(const CacheRecord*)((const char*)mapped + offset);
+    }
+
+    const CacheRecord& lookup(uint64_t location) const {
+        return (location & PENDING) ? fresh[(location & ~PENDING) - freshBase] : recordAt(location);
+    }
+
+    template <typename F>
+    void update(uint64_t key, F change) {
+        if (fd < 0) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> guard(lock);
+        if (appendFailed) {
+            return;
+        }
+        CacheRecord record = {};
+        auto it = index.find(key);
+        if (it != index.end()) {
+            record = lookup(it->second);
+        }
+        record.key = key;
+        change(record);
+        fresh.push_back(record);
+        index[key] = PENDING | (freshBase + fresh.size() - 1);
+        if (fresh.size() >= FLUSH_BATCH) {
+            flushLocked();
+        }
+    }
+
+    // Writes the fresh records not yet in the file, maps the grown file and
+    // points the index at the mapped copies, so fresh only ever holds one
+    // batch. A failed write cuts a partial record back off, as open() does
+    // with a torn tail, and ends appending for this process; records
+    // written while the remap fails wait for the next flush to be mapped.
+    void flushLocked() {
+        while (!appendFailed && writtenAt.size() < fresh.size()) {
+            ssize_t n = write(fd, &fresh[writtenAt.size()], sizeof(CacheRecord));
+            if (n == (ssize_t)sizeof(CacheRecord)) {
+                writtenAt.push_back(lseek(fd, 0, SEEK_CUR) - sizeof(CacheRecord));
+                continue;
+            }
+            if (n > 0) {
+                int cut = ftruncate(fd, lseek(fd, 0, SEEK_CUR) - n);
+                (void)cut;  // if this fails too, open() cuts the torn tail next time
+            }
+            appendFailed = true;
+        }
+        if (writtenAt.empty() || !remap()) {
+            return;
+        }
+        for (uint64_t offset : writtenAt) {
+            auto it = index.find(fresh.front().key);
+            if (it != index.end() && it->second == (PENDING | freshBase)) {
+                it->second = offset;
+            }
+            fresh.pop_front();
+            freshBase++;
+        }
+        writtenAt.clear();
+    }
+
+    // Maps the whole file again after it has grown
+    bool remap() {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        if ((size_t)st.st_size <= mappedLength) {
+            return true;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        if (mapped) {
+            munmap(mapped, mappedLength);
+        }
+        mapped = map;
+        mappedLength = st.st_size;
+        return true;
+    }
+
+    int fd = -1;
+    void* mapped = nullptr;
+    size_t mappedLength = 0;
+    std::unordered_map<uint64_t, uint64_t> index;  // key to file offset, or PENDING | fresh number
+    std::deque<CacheRecord> fresh;                 // records not yet mapped
+    std::vector<uint64_t> writtenAt;               // file offsets of fresh's first records already written
+    uint64_t freshBase = 0;                        // number of fresh.front()
+    bool appendFailed = false;
+    std::shared_mutex lock;
+};
+
+// Process-wide cache the engines consult; inactive until open() succeeds
+inline AnalysisCache analysisCache;
+
+#endif
@@ -0,0 +1,169 @@
+// Self-play arena: plays many games between two engine configurations in
+// parallel and reports the result, an Elo estimate and nodes/sec per side.
+//
+// Build: g++ -O2 -mavx2 -mfma -pthread connect4_arena.cpp -o connect4_arena
+// Run:   ./connect4_arena --a minimax:depth=6 --b mcts:sims=2000 --games 1000
+//
+// Engine specs are the ones accepted by parseEngineConfig. Every opening is
+// played twice with colours swapped, so --games should be even. Nodes per
+// move compare search algorithms at equal depth, e.g.
+//        ./connect4_arena --a minimax:depth=8 --b minimax:depth=8,search=mtdf
+#include "connect4_engines.h"
+
+#include <thread>
+
+struct ArenaConfig {
+    EngineConfig a;
+    EngineConfig b;
+    string specA = "minimax";
+    string specB = "mcts";
+    int games = 100;
+    unsigned int threads = max(1u, thread::hardware_concurrency());
+    int openingPlies = 2;
+    unsigned int seed = 1;
+};
+
+struct SideStats {
+    atomic<uint64_t> nodes{0};
+    atomic<uint64_t> nanoseconds{0};
+    atomic<uint64_t> moves{0};
+    atomic<uint64_t> peakTreeBytes{0};
+};
+
+ArenaConfig arena;
+atomic<int> nextGame{0};
+atomic<int> winsA{0}, draws{0}, winsB{0};
+SideStats statsA, statsB;
+
+// Random legal opening of arena.openingPlies moves that does not end the game
+string randomOpening(mt19937& rng) {
+    while (true) {
+        string moves;
+        std::vector<int> board;
+        int toMove;
+        bool finished = false;
+        for (int i = 0; i < arena.openingPlies && !finished; i++) {
+            moves += (char)('0' + rng() % BOARD_WIDTH);
+            if (!replayMoves(moves, board, toMove, finished)) {
+                moves.pop_back();
+                i--;
+            }
+        }
+        if (!finished) {
+            return moves.empty() ? "-" : moves;
+        }
+    }
+}
+
+// Plays game number g. Returns +1 if A wins, -1 if B wins and 0 for a draw.
+int playGame(int g) {
+    mt19937 rng(arena.seed + g / 2);
+    string moves = randomOpening(rng);
+    bool aFirst = (g % 2 == 0);
+    EngineState stateA, stateB;
+    std::vector<int> board;
+    int toMove;
+    bool finished;
+    replayMoves(moves, board, toMove, finished);
+    while (!finished) {
+        bool aToMove = ((toMove == PLAYER1) == aFirst);
+        auto start = chrono::steady_clock::now();
+        EngineResult result = aToMove ? engineSearch(arena.a, stateA, moves) : engineSearch(arena.b, stateB, moves);
+        uint64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        SideStats& side = aToMove ? statsA : statsB;
+        side.nodes += result.nodes;
+        side.nanoseconds += elapsed;
+        side.moves++;
+        uint64_t seen = side.peakTreeBytes;
+        while (result.treeBytes > seen && !side.peakTreeBytes.compare_exchange_weak(seen, result.treeBytes)) {}
+        moves = (moves == "-" ? "" : moves) + (char)('0' + result.column);
+        int mover = toMove;
+        replayMoves(moves, board, toMove, finished);
+        if (checkWin(board, mover)) {
+            return aToMove ? 1 : -1;
+        }
+    }
+    return 0;
+}
+
+void worker() {
+    int g;
+    while ((g = nextGame++) < arena.games) {
+        int result = playGame(g);
+        if (result > 0) { winsA++; }
+        else if (result < 0) { winsB++; }
+        else { draws++; }
+    }
+}
+
+// Elo difference implied by a score fraction, clamped away from 0 and 1
+double eloFromScore(double score) {
+    score = min(max(score, 1e-6), 1 - 1e-6);
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+void report(double seconds) {
+    int n = winsA + draws + winsB;
+    double score = (winsA + 0.5 * draws) / n;
+    // Per-game variance of the score, then a 95% normal interval on the mean
+    double variance = (winsA * pow(1 - score, 2) + draws * pow(0.5 - score, 2) + winsB * pow(score, 2)) / n;
+    double margin = 1.96 * sqrt(variance / n);
+    cout << "Games: " << n << " in " << fixed << setprecision(1) << seconds << " s" << endl;
+    cout << "A " << arena.specA << ": " << winsA << " wins, " << draws << " draws, " << winsB << " losses" << endl;
+    cout << "Score A: " << setprecision(1) << 100 * score << "%  Elo A-B: " << showpos << setprecision(0)
+         << eloFromScore(score) << " [" << eloFromScore(score - margin) << ", " << eloFromScore(score + margin)
+         << "] (95%)" << noshowpos << endl;
+    for (int i = 0; i < 2; i++) {
+        SideStats& side = (i == 0) ? statsA : statsB;
+        double sideSeconds = side.nanoseconds / 1e9;
+        cout << (i == 0 ? "A " + arena.specA : "B " + arena.specB) << ": " << setprecision(0)
+             << (sideSeconds > 0 ? side.nodes / sideSeconds : 0) << " nodes/sec, "
+             << (side.moves > 0 ? side.nodes / (double)side.moves : 0) << " nodes/move";
+        if (side.peakTreeBytes > 0) {
+            cout << ", peak tree " << side.peakTreeBytes / 1024 << " KB";
+        }
+        cout << endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        istringstream value(argv[i + 1]);
+        if (flag == "--a") { value >> arena.specA; }
+        else if (flag == "--b") { value >> arena.specB; }
+        else if (flag == "--games") { value >> arena.games; }
+        else if (flag == "--threads") { value >> arena.threads; }
+        else if (flag == "--openings") { value >> arena.openingPlies; }
+        else if (flag == "--seed") { value >> arena.seed; }
+        else if (flag == "--endgame") {
+            if (!endgameDB.open(argv[i + 1])) { cout << "Could not load endgame database " << argv[i + 1] << endl; return 1; }
+        }
+        else if (flag == "--cache") {
+            if (!analysisCache.open(argv[i + 1])) { cout << "Could not open analysis cache " << argv[i + 1] << endl; return 1; }
+        }
+        else if (flag == "--value-net") {
+            if (!valueNet.load(argv[i + 1])) { cout << "Could not load value net " << argv[i + 1] << endl; return 1; }
+        }
+        else { cout << "Unknown option " << flag << endl; return 1; }
+    }
+    if (!parseEngineConfig(arena.specA, arena.a) || !parseEngineConfig(arena.specB, arena.b) || arena.games <= 0) {
+        cout << "Usage: " << argv[0] << " --a SPEC --b SPEC [--games N] [--threads N] [--openings PLIES] [--seed S] [--endgame FILE] [--cache FILE] [--value-net FILE]" << endl;
+        return 1;
+    }
+    arena.threads = max(1u, arena.threads);
+    // Games are the unit of parallelism, one search per thread
+    if (arena.threads > 1) {
+        SEARCH_THREADS = 1;
+    }
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned int i = 0; i < arena.threads; i++) {
+        workers.emplace_back(worker);
+    }
+    for (thread& t : workers) {
+        t.join();
+    }
+    report(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    return 0;
+}
@@ -0,0 +1,253 @@
+// Bitboard position and board kernels with the geometry fixed at compile
+// time, so every mask is a constant and every loop over the board unrolls.
+// Bits are column-major, bit (col * (H + 1) + row) with row 0 at the bottom,
+// plus one spare bit on top of each column so shifts never wrap.
+//
+// Only 7x6 (BitBoard) is instantiated: the engines, the endgame database,
+// the analysis cache and the position keys all assume that board.
+#ifndef CONNECT4_BITBOARD_H
+#define CONNECT4_BITBOARD_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+inline int popcount(uint64_t x) { return __builtin_popcountll(x); }
+
+// heurFunction-style score for every (own, opponent) split of a window
+typedef std::array<std::array<int, 5>, 5> WindowScores;
+
+template <int W, int H>
+struct BasicBitBoard {
+    static_assert(W >= 4 && H >= 4, "boards need room for a line of four");
+    static_assert(W * (H + 1) <= 64, "board does not fit in 64 bits");
+
+    typedef uint64_t Bits;
+
+    static const int WIDTH = W;
+    static const int HEIGHT = H;
+    // Lines of four: horizontal, vertical and both diagonals
+    static const int NUM_WINDOWS = H * (W - 3) + W * (H - 3) + 2 * (W - 3) * (H - 3);
+
+    Bits current = 0;  // stones of the side to move
+    Bits mask = 0;     // all stones
+    int moves = 0;
+
+    static constexpr Bits cell(int col, int row) { return Bits(1) << (col * (H + 1) + row); }
+    static constexpr Bits bottom(int col) { return cell(col, 0); }
+    static constexpr Bits top(int col) { return cell(col, H - 1); }
+    static constexpr Bits column(int col) { return ((Bits(1) << H) - 1) << (col * (H + 1)); }
+
+    // Bottom cell of every column, and every cell of the board
+    static constexpr Bits bottomRow() {
+        Bits r = 0;
+        for (int col = 0; col < W; col++) r |= bottom(col);
+        return r;
+    }
+    static constexpr Bits boardMask() { return bottomRow() * ((Bits(1) << H) - 1); }
+
+    bool canPlay(int col) const { return (mask & top(col)) == 0; }
+
+    // Cells the next stone can go to, one per column that is not full
+    Bits possible() const { return (mask + bottomRow()) & boardMask(); }
+
+    void play(int col) {
+        current ^= mask;
+        mask |= mask + bottom(col);
+        moves++;
+    }
+
+    bool isWinningMove(int col) const {
+        return alignment(current | ((mask + bottom(col)) & column(col)));
+    }
+
+    bool full() const { return moves == W * H; }
+
+    // Unique for every position with the side to move implied by moves.
+    // current + mask never carries out of a column, so keys mirror like boards.
+    Bits key() const { return current + mask; }
+
+    // Left-right mirror image of a set of bits
+    static Bits mirror(Bits x) {
+        const Bits columnBits = (Bits(1) << (H + 1)) - 1;
+        Bits r = 0;
+        #pragma GCC unroll 16
+        for (int col = 0; col < W; col++) {
+            r |= ((x >> (col * (H + 1))) & columnBits) << ((W - 1 - col) * (H + 1));
+        }
+        return r;
+    }
+
+    // The smaller of key() and the mirrored position's key; mirrored tells
+    // which one it is, so moves stored under it can be flipped back
+    Bits canonicalKey(bool& mirrored) const {
+        Bits k = key();
+        Bits m = mirror(k);
+        mirrored = m < k;
+        return mirrored ? m : k;
+    }
+
+    bool symmetric() const { return mirror(key()) == key(); }
+
+    // Inverse of key(). A column of height h has mask 2^h - 1 and current at
+    // most that, so its part of the key lies in [2^h - 1, 2^(h+1) - 2].
+    static BasicBitBoard fromKey(Bits key) {
+        BasicBitBoard b;
+        for (int col = 0; col < W; col++) {
+            Bits v = (key >> (col * (H + 1))) & ((Bits(1) << (H + 1)) - 1);
+            int h = 0;
+            while (h < H && (Bits(1) << (h + 1)) - 1 <= v) {
+                h++;
+            }
+            Bits columnMask = (Bits(1) << h) - 1;
+            b.mask |= columnMask << (col * (H + 1));
+            b.current |= (v - columnMask) << (col * (H + 1));
+            b.moves += h;
+        }
+        return b;
+    }
+
+    static bool alignment(Bits pos) {
+        Bits m = pos & (pos >> (H + 1));  // horizontal
+        if (m & (m >> (2 * (H + 1)))) return true;
+        m = pos & (pos >> H);             // diagonal, down to the right
+        if (m & (m >> (2 * H))) return true;
+        m = pos & (pos >> (H + 2));       // diagonal, up to the right
+        if (m & (m >> (2 * (H + 2)))) return true;
+        m = pos & (pos >> 1);             // vertical
+        return (m & (m >> 2)) != 0;
+    }
+
+    // Empty cells that would complete a line of four for pos, playable now
+    // or not
+    static Bits winningCells(Bits pos, Bits occupied) {
+        Bits r = (pos << 1) & (pos << 2) & (pos << 3);  // vertical
+        #pragma GCC unroll 3
+        for (int shift : {H + 1, H, H + 2}) {           // horizontal and both diagonals
+            Bits p = (pos << shift) & (pos << 2 * shift);
+            r |= p & (pos << 3 * shift);
+            r |= p & (pos >> shift);
+            p = (pos >> shift) & (pos >> 2 * shift);
+            r |= p & (pos << shift);
+            r |= p & (pos >> 3 * shift);
+        }
+        return r & (boardMask() ^ occupied);
+    }
+
+    // Every window as a mask, plus the cell countOpenThrees lets be empty:
+    // the leftmost cell of horizontal and diagonal windows, the top of vertical ones
+    struct Windows {
+        Bits all[NUM_WINDOWS];
+        Bits open[NUM_WINDOWS];
+
+        constexpr Windows() : all(), open() {
+            int n = 0;
+            for (int row = 0; row < H; row++) {
+                for (int col = 0; col + 3 < W; col++, n++) {
+                    for (int i = 0; i < 4; i++) all[n] |= cell(col + i, row);
+                    open[n] = cell(col, row);
+                }
+            }
+            for (int col = 0; col < W; col++) {
+                for (int row = 0; row + 3 < H; row++, n++) {
+                    for (int i = 0; i < 4; i++) all[n] |= cell(col, row + i);
+                    open[n] = cell(col, row + 3);
+                }
+            }
+            for (int row = 0; row + 3 < H; row++) {
+                for (int col = 0; col + 3 < W; col++, n++) {
+                    for (int i = 0; i < 4; i++) all[n] |= cell(col + i, row + i);
+                    open[n] = cell(col, row);
+                }
+            }
+            for (int row = 3; row < H; row++) {
+                for (int col = 0; col + 3 < W; col++, n++) {
+                    for (int i = 0; i < 4; i++) all[n] |= cell(col + i, row - i);
+                    open[n] = cell(col, row);
+                }
+            }
+        }
+    };
+
+    static constexpr Windows WINDOWS{};
+
+    // Sum of scores[own stones][opponent stones] over every window
+    static int scoreWindows(Bits own, Bits opp, const WindowScores& scores) {
+        int score = 0;
+        #pragma GCC unroll 128
+        for (int i = 0; i < NUM_WINDOWS; i++) {
+            score += scores[popcount(own & WINDOWS.all[i])][popcount(opp & WINDOWS.all[i])];
+        }
+        return score;
+    }
+
+    // Windows holding three own stones whose remaining (open) cell is free or own
+    static int countOpenThrees(Bits own, Bits opp) {
+        int count = 0;
+        #pragma GCC unroll 128
+        for (int i = 0; i < NUM_WINDOWS; i++) {
+            Bits rest = WINDOWS.all[i] & ~WINDOWS.open[i];
+            count += ((own & rest) == rest && (opp & WINDOWS.open[i]) == 0) ? 1 : 0;
+        }
+        return count;
+    }
+
+    // Stones of player and all stones, from the minimax layout (rows[0] at the bottom)
+    static void fromRows(const std::vector<std::vector<int>>& rows, int player, Bits& own, Bits& occupied) {
+        own = 0;
+        occupied = 0;
+        #pragma GCC unroll 16
+        for (int row = 0; row < H; row++) {
+            #pragma GCC unroll 16
+            for (int col = 0; col < W; col++) {
+                int v = rows[row][col];
+                own |= (v == player) ? cell(col, row) : 0;
+                occupied |= (v != 0) ? cell(col, row) : 0;
+            }
+        }
+    }
+
+    // Stones of player and all stones, from the MCTS layout (row 0 at the top)
+    static void fromCells(const std::vector<int>& board, int player, Bits& own, Bits& occupied) {
+        own = 0;
+        occupied = 0;
+        #pragma GCC unroll 128
+        for (int i = 0; i < W * H; i++) {
+            int v = board[i];
+            Bits bit = cell(i % W, H - 1 - i / W);
+            own |= (v == player) ? bit : 0;
+            occupied |= (v != 0) ? bit : 0;
+        }
+    }
+
+    static BasicBitBoard make(Bits own, Bits occupied) {
+        BasicBitBoard b;
+        b.current = own;
+        b.mask = occupied;
+        b.moves = popcount(occupied);
+        return b;
+    }
+};
+
+template <int W, int H>
+constexpr typename BasicBitBoard<W, H>::Windows BasicBitBoard<W, H>::WINDOWS;
+
+template struct BasicBitBoard<7, 6>;
+
+typedef BasicBitBoard<7, 6> BitBoard;
+
+// From the MCTS layout (row 0 at the top, cells 0/1/2)
+inline BitBoard bitBoardFromCells(const std::vector<int>& board, int toMove) {
+    BitBoard::Bits own, occupied;
+    BitBoard::fromCells(board, toMove, own, occupied);
+    return BitBoard::make(own, occupied);
+}
+
+// From the minimax layout (row 0 at the bottom, cells 0/1/2)
+inline BitBoard bitBoardFromRows(const std::vector<std::vector<int>>& rows, int toMove) {
+    BitBoard::Bits own, occupied;
+    BitBoard::fromRows(rows, toMove, own, occupied);
+    return BitBoard::make(own, occupied);
+}
+
+#endif
@@ -0,0 +1,510 @@
+// In-process access to the minimax and MCTS engines for the tools that drive
+// them (server, arena, ...) without going through the interactive mains.
+// Positions are exchanged as the sequence of columns played from the empty
+// board and held internally in the MCTS layout (row 0 at the top).
+#ifndef CONNECT4_ENGINES_H
+#define CONNECT4_ENGINES_H
+
+#define CONNECT4_NO_MAIN
+#include "min_max_connect4.cpp"
+#include "mcts_connect4.cpp"
+
+#include <functional>
+#include <memory>
+
+enum EngineKind { ENGINE_MINIMAX, ENGINE_MINIMAX_PARALLEL, ENGINE_MCTS, ENGINE_MCTS_PARALLEL_1, ENGINE_MCTS_PARALLEL_2,
+                  ENGINE_MCTS_BATCHED };
+
+struct EngineConfig {
+    EngineKind kind = ENGINE_MINIMAX;
+    unsigned int depth = NUM_ROW * NUM_COL;  // minimax depth limit
+    long moveTimeMs = 0;                     // per-move time budget, 0 = none
+    int simulations = NUM_SIMULATIONS;       // MCTS simulations per move
+    double exploration = C_PUCT;             // MCTS exploration weight
+    bool valueNet = false;                   // MCTS leaves from valueNet instead of rollouts
+    bool heavyPlayouts = false;              // MCTS rollouts by heavyRollout
+    bool priors = true;                      // MCTS PUCT selection with move priors instead of UCT
+    double rave = 0;                         // MCTS RAVE equivalence parameter, 0 = no RAVE
+    int solveEmpty = 0;                      // MCTS nodes with at most this many empty cells solved exactly, 0 = none
+    int batch = LEAF_BATCH;                  // mcts-batched leaves per evaluation batch
+    size_t maxNodes = 0;                     // MCTS tree node budget, 0 = unbounded
+    uint64_t seed = 0;                       // nonzero for a reproducible search, see SearchState and simulationSeed
+    size_t ttEntries = 1 << 16;              // minimax transposition table size
+    SearchAlgorithm search = SEARCH_ALPHABETA;
+    int aspiration = 0;                      // minimax aspiration window half-width, 0 = full window
+    int threats = THREAT_DEPTH;              // attacker moves of the forcedMove pre-search, 0 = none
+};
+
+// Engine state a game keeps between its moves
+struct EngineState {
+    std::unique_ptr<TranspositionTable> tt;
+    Node* root = nullptr;
+    std::string moves;
+
+    ~EngineState() { delete root; }
+};
+
+struct EngineResult {
+    int column = -1;
+    uint64_t nodes = 0;  // minimax nodes, or MCTS root visits added by the search
+    size_t treeBytes = 0;  // MCTS tree memory at its peak during the search
+};
+
+// Progress of a search, after each completed minimax depth or MCTS slice
+struct EngineInfo {
+    unsigned int depth = 0;  // minimax depth, or the length of the MCTS principal variation
+    uint64_t nodes = 0;      // as in EngineResult, or spent on this line in an analysis
+    int score = 0;           // minimax score, or the MCTS value of the first move in thousandths
+    std::vector<int> pv;     // columns from the searched position
+    int rank = 0;            // place of the line in an engineAnalyze ranking from 1, 0 outside one
+};
+
+// Control over a search from another thread. stop ends it within a
+// simulation or a node, returning the best move found so far. info, when
+// set, is called on the searching thread; an MCTS search then runs in slices
+// of infoIntervalMs so that it has something to report. maxDepth and
+// maxSimulations, 0 for none, may be lowered while the search runs: minimax
+// starts no deeper iteration, and a sliced MCTS search stops once its
+// simulations reach the limit.
+struct EngineControl {
+    std::atomic<bool> stop{false};
+    std::function<void(const EngineInfo&)> info;
+    long infoIntervalMs = 100;
+    std::atomic<unsigned int> maxDepth{0};
+    std::atomic<uint64_t> maxSimulations{0};
+};
+
+bool depthAllowed(const EngineControl* control, unsigned int d) {
+    unsigned int limit = control ? control->maxDepth.load() : 0;
+    return limit == 0 || d <= limit;
+}
+
+// Parses "kind[:key=value,...]" where kind is minimax, minimax-parallel, mcts,
+// mcts-parallel-1, mcts-parallel-2 or mcts-batched and keys are depth, ms,
+// sims, c, tt, search (ab, pvs or mtdf), window (aspiration half-width), eval
+// (rollout, heavy or net, the MCTS leaf evaluator), select (puct or uct, the
+// MCTS selection rule), rave (RAVE equivalence, 0 for none), batch (leaves
+// per mcts-batched evaluation), nodes (the MCTS tree node budget), solve
+// (empty cells at which MCTS nodes are solved exactly, 0 for never), seed
+// (nonzero for the reproducible mode) and threats (attacker moves of the
+// tactical pre-search, 0 to search every position).
+bool parseEngineConfig(const std::string& spec, EngineConfig& config) {
+    std::string kind = spec.substr(0, spec.find(':'));
+    if (kind == "minimax") { config.kind = ENGINE_MINIMAX; }
+    else if (kind == "minimax-parallel") { config.kind = ENGINE_MINIMAX_PARALLEL; }
+    else if (kind == "mcts") { config.kind = ENGINE_MCTS; }
+    else if (kind == "mcts-parallel-1") { config.kind = ENGINE_MCTS_PARALLEL_1; }
+    else if (kind == "mcts-parallel-2") { config.kind = ENGINE_MCTS_PARALLEL_2; }
+    else if (kind == "mcts-batched") { config.kind = ENGINE_MCTS_BATCHED; }
+    else { return false; }
+    if (kind.size() == spec.size()) {
+        return true;
+    }
+    std::istringstream options(spec.substr(kind.size() + 1));
+    std::string option;
+    while (std::getline(options, option, ',')) {
+        size_t eq = option.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = option.substr(0, eq);
+        std::istringstream value(option.substr(eq + 1));
+        if (key == "search") {
+            if (!parseSearchAlgorithm(value.str(), config.search)) { return false; }
+        }
+        else if (key == "eval") {
+            if (value.str() != "rollout" && value.str() != "heavy" && value.str() != "net") { return false; }
+            config.valueNet = (value.str() == "net");
+            config.heavyPlayouts = (value.str() == "heavy");
+        }
+        else if (key == "select") {
+            if (value.str() != "puct" && value.str() != "uct") { return false; }
+            config.priors = (value.str() == "puct");
+        }
+        else if (key == "depth") { value >> config.depth; }
+        else if (key == "ms") { value >> config.moveTimeMs; }
+        else if (key == "sims") { value >> config.simulations; }
+        else if (key == "c") { value >> config.exploration; }
+        else if (key == "rave") { value >> config.rave; }
+        else if (key == "solve") { value >> config.solveEmpty; }
+        else if (key == "tt") { value >> config.ttEntries; }
+        else if (key == "window") { value >> config.aspiration; }
+        else if (key == "batch") { value >> config.batch; }
+        else if (key == "nodes") { value >> config.maxNodes; }
+        else if (key == "seed") { value >> config.seed; }
+        else if (key == "threats") { value >> config.threats; }
+        else { return false; }
+        if (!value || config.batch < 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isMinimax(const EngineConfig& config) {
+    return config.kind == ENGINE_MINIMAX || config.kind == ENGINE_MINIMAX_PARALLEL;
+}
+
+// Replays moves ("-" for none) on an MCTS-layout board. Fails on an illegal
+// column or a move played after the game was decided; finished reports
+// whether the resulting position is won or drawn.
+bool replayMoves(const std::string& moves, std::vector<int>& board, int& toMove, bool& finished) {
+    board.assign(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
+    toMove = PLAYER1;
+    finished = false;
+    if (moves == "-") {
+        return true;
+    }
+    for (char ch : moves) {
+        int col = ch - '0';
+        if (finished || col < 0 || col >= BOARD_WIDTH || findFirstEmptyRow(board, col) == -1) {
+            return false;
+        }
+        board[findFirstEmptyRow(board, col) * BOARD_WIDTH + col] = toMove;
+        finished = checkWin(board, toMove) || checkDraw(board);
+        toMove = (toMove == PLAYER1) ? PLAYER2 : PLAYER1;
+    }
+    return true;
+}
+
+int firstLegalColumn(const std::vector<int>& board) {
+    for (int col = 0; col < BOARD_WIDTH; col++) {
+        if (findFirstEmptyRow(board, col) != -1) return col;
+    }
+    return -1;
+}
+
+// Converts to the minimax layout (row 0 at the bottom). miniMax always
+// maximises for AI, so the side to move is recoloured as AI.
+vector<vector<int>> toMinimaxBoard(const std::vector<int>& board, int toMove) {
+    vector<vector<int>> b(NUM_ROW, vector<int>(NUM_COL));
+    for (unsigned int r = 0; r < NUM_ROW; r++) {
+        for (unsigned int c = 0; c < NUM_COL; c++) {
+            int cell = board[(BOARD_HEIGHT - 1 - r) * BOARD_WIDTH + c];
+            b[r][c] = (cell == EMPTY) ? 0 : (cell == toMove) ? AI : PLAYER;
+        }
+    }
+    return b;
+}
+
+// One iteration of searchMinimax with the window [alf, bet]
+array<int, 2> searchWindow(const EngineConfig& config, vector<vector<int>>& b, unsigned int d, int alf, int bet,
+                           SearchState* s) {
+    if (config.search == SEARCH_PVS) {
+        return miniMaxPVS(b, d, alf, bet, AI, s);
+    }
+    return (config.kind == ENGINE_MINIMAX_PARALLEL) ? miniMaxParallel(b, d, alf, bet, AI, s)
+                                                    : miniMax(b, d, alf, bet, AI, s);
+}
+
+// Principal variation of a minimax search: move, then the best replies the
+// transposition table holds, at most d columns
+std::vector<int> minimaxPV(TranspositionTable* tt, vector<vector<int>> b, int move, unsigned int d) {
+    std::vector<int> pv;
+    unsigned int p = AI;
+    while (move >= 0 && (unsigned int)move < NUM_COL && b[NUM_ROW - 1][move] == 0 && pv.size() < d) {
+        pv.push_back(move);
+        makeMove(b, move, p);
+        if (winningMove(b, p) || boardFull(b)) {
+            break;
+        }
+        p = (p == AI) ? PLAYER : AI;
+        int score, flag;
+        unsigned int depth;
+        bool mirrored;
+        if (!tt->probe(positionKey(b, p, &mirrored), score, move, depth, flag)) {
+            break;
+        }
+        if (mirrored && move >= 0) {
+            move = NUM_COL - 1 - move;
+        }
+    }
+    return pv;
+}
+
+// Iterative deepening up to config.depth, keeping the move of the last
+// completed iteration when the deadline cuts one short. Each iteration starts
+// from the previous score: as the first guess for MTD(f), or as the centre of
+// an aspiration window that is widened to the full window when the score
+// falls outside it.
+EngineResult searchMinimax(const EngineConfig& config, EngineState& state, const std::vector<int>& board, int toMove,
+                           chrono::steady_clock::time_point deadline, EngineControl* control) {
+    if (!state.tt) {
+        state.tt.reset(new TranspositionTable(config.ttEntries));
+    }
+    vector<vector<int>> b = toMinimaxBoard(board, toMove);
+    unsigned int empty = (unsigned int)std::count(board.begin(), board.end(), EMPTY);
+    SearchState s;
+    s.tt = state.tt.get();
+    s.deadline = deadline;
+    s.deterministic = (config.seed != 0);
+    s.cancel = control ? &control->stop : nullptr;
+    EngineResult result;
+    int previous = 0;
+    for (unsigned int d = 1; d <= min(empty, config.depth) && depthAllowed(control, d); d++) {
+        array<int, 2> best;
+        if (config.search == SEARCH_MTDF) {
+            best = mtdf(b, d, previous, &s);
+        } else if (config.aspiration > 0 && d > 1) {
+            int alf = (int)max<int64_t>((int64_t)previous - config.aspiration, 0 - INT_MAX);
+            int bet = (int)min<int64_t>((int64_t)previous + config.aspiration, INT_MAX);
+            best = searchWindow(config, b, d, alf, bet, &s);
+            if (!s.stop.load() && (best[0] <= alf || best[0] >= bet)) {
+                best = searchWindow(config, b, d, 0 - INT_MAX, INT_MAX, &s);
+            }
+        } else {
+            best = searchWindow(config, b, d, 0 - INT_MAX, INT_MAX, &s);
+        }
+        if (s.stop.load()) {
+            break;
+        }
+        previous = best[0];
+        if (best[1] != -1) {
+            result.column = best[1];
+            analysisCache.storeSearch(bitBoardFromCells(board, toMove), d, best[0], best[1]);
+        }
+        if (control && control->info) {
+            EngineInfo info;
+            info.depth = d;
+            info.nodes = s.nodes.load();
+            info.score = best[0];
+            info.pv = minimaxPV(s.tt, b, result.column, d);
+            control->info(info);
+        }
+    }
+    result.nodes = s.nodes.load();
+    return result;
+}
+
+// Most visited line from root, with its first move's value
+EngineInfo mctsInfo(const Node* root, uint64_t nodes) {
+    EngineInfo info;
+    info.nodes = nodes;
+    for (const Node* node = root; node != nullptr;) {
+        const Node* best = nullptr;
+        int col = -1;
+        for (int c = 0; c < BOARD_WIDTH; c++) {
+            const Node* child = node->children[c];
+            if (child != nullptr && child->visit_count > 0 && (best == nullptr || child->visit_count > best->visit_count)) {
+                best = child;
+                col = c;
+            }
+        }
+        if (best == nullptr) {
+            break;
+        }
+        if (node == root) {
+            info.score = (int)std::lround(1000 * best->total_reward / best->visit_count);
+        }
+        info.pv.push_back(col);
+        node = best;
+    }
+    info.depth = info.pv.size();
+    return info;
+}
+
+// One search of the resident tree by the configured MCTS variant
+std::vector<int> runMcts(const EngineConfig& config, Node* root, int simulations,
+                         chrono::steady_clock::time_point deadline, const std::atomic<bool>* stop) {
+    if (config.kind == ENGINE_MCTS_PARALLEL_1) {
+        return mcts_parallel_1(root, simulations, deadline, stop);
+    } else if (config.kind == ENGINE_MCTS_PARALLEL_2) {
+        return mcts_parallel_2(root, simulations, deadline, stop);
+    } else if (config.kind == ENGINE_MCTS_BATCHED) {
+        return mcts_batched(root, simulations, deadline, config.batch, stop);
+    }
+    return mcts(root, simulations, deadline, stop);
+}
+
+// Advances the resident tree along the moves played since the previous
+// search, or rebuilds it when the history does not extend the stored one.
+EngineResult searchMcts(const EngineConfig& config, EngineState& state, const std::string& moves,
+                        const std::vector<int>& board, int toMove, chrono::steady_clock::time_point deadline,
+                        EngineControl* control) {
+    std::string played = (moves == "-") ? "" : moves;
+    if (state.root != nullptr && played.compare(0, state.moves.size(), state.moves) == 0) {
+        for (size_t i = state.moves.size(); i < played.size(); i++) {
+            state.root = advanceRoot(state.root, played[i] - '0');
+        }
+    } else {
+        delete state.root;
+        state.root = new Node(board, toMove);
+    }
+    state.moves = played;
+    mcts_settings.exploration_weight = config.exploration;
+    mcts_settings.value_net = config.valueNet;
+    mcts_settings.heavy_playouts = config.heavyPlayouts;
+    mcts_settings.priors = config.priors;
+    mcts_settings.rave_equivalence = config.rave;
+    mcts_settings.solve_empty = config.solveEmpty;
+    mcts_settings.max_nodes = config.maxNodes;
+    mcts_settings.seed = config.seed;
+    int visits = state.root->visit_count;
+    const std::atomic<bool>* stop = control ? &control->stop : nullptr;
+    std::vector<int> after;
+    if (control && control->info) {
+        // Slices until the simulations, the deadline or a stop run out
+        size_t peak = 0;
+        uint64_t ran = 0;
+        for (int remaining = config.simulations; remaining > 0;) {
+            int slice = remaining;
+            uint64_t limit = control->maxSimulations.load();
+            if (limit > 0) {
+                slice = (int)min<uint64_t>(slice, limit > ran ? limit - ran : 1);
+            }
+            auto now = chrono::steady_clock::now();
+            after = runMcts(config, state.root, slice, min(deadline, now + chrono::milliseconds(control->infoIntervalMs)), stop);
+            remaining -= mcts_simulations;
+            ran += mcts_simulations;
+            peak = max(peak, mcts_memory.bytes());
+            control->info(mctsInfo(state.root, state.root->visit_count - visits));
+            limit = control->maxSimulations.load();
+            if (mcts_simulations == 0 || stop->load() || chrono::steady_clock::now() >= deadline ||
+                (limit > 0 && ran >= limit)) {
+                break;
+            }
+        }
+        mcts_memory.peak_nodes = peak / NODE_BYTES;
+    } else {
+        after = runMcts(config, state.root, config.simulations, deadline, stop);
+    }
+    EngineResult result;
+    result.column = moveColumn(state.root->board, after);
+    result.nodes = state.root->visit_count - visits;
+    result.treeBytes = mcts_memory.bytes();
+    return result;
+}
+
+// Searches the position reached by moves, which must not be finished. The
+// deadline is the earlier of the one given and config.moveTimeMs from now;
+// control optionally lets another thread stop the search and follow it.
+EngineResult engineSearch(const EngineConfig& config, EngineState& state, const std::string& moves,
+                          chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max(),
+                          EngineControl* control = nullptr) {
+    std::vector<int> board;
+    int toMove;
+    bool finished;
+    replayMoves(moves, board, toMove, finished);
+    if (config.moveTimeMs > 0) {
+        deadline = min(deadline, chrono::steady_clock::now() + chrono::milliseconds(config.moveTimeMs));
+    }
+    BitBoard position = bitBoardFromCells(board, toMove);
+    EndgameEntry entry;
+    if (endgameDB.probe(position, entry)) {
+        EngineResult solved;
+        solved.column = entry.move;
+        return solved;
+    }
+    ForcedMove forced = forcedMove(position, config.threats);
+    if (forced.move != -1) {
+        EngineResult tactical;
+        tactical.column = forced.move;
+        return tactical;
+    }
+    EngineResult result = isMinimax(config) ? searchMinimax(config, state, board, toMove, deadline, control)
+                                            : searchMcts(config, state, moves, board, toMove, deadline, control);
+    if (result.column < 0 || findFirstEmptyRow(board, result.column) == -1) {
+        result.column = firstLegalColumn(board);
+    }
+    return result;
+}
+
+// Scores every legal column of the position reached by moves, which must not
+// be finished, and returns them best first as lines whose pv starts with the
+// column. Minimax searches each column with a full window, the columns of
+// one depth in parallel as scheduler tasks sharing the game's transposition
+// table, so later columns and depths find the earlier ones' work there. It
+// deepens up to config.depth and keeps the last depth every column finished.
+// MCTS runs mcts_parallel_2, whatever the variant configured, since it gives
+// every column the same share of the simulations. The tactical pre-search
+// and the endgame database are not consulted, every column gets its score.
+std::vector<EngineInfo> engineAnalyze(const EngineConfig& config, EngineState& state, const std::string& moves,
+                                      chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max(),
+                                      EngineControl* control = nullptr) {
+    std::vector<int> board;
+    int toMove;
+    bool finished;
+    replayMoves(moves, board, toMove, finished);
+    if (config.moveTimeMs > 0) {
+        deadline = min(deadline, chrono::steady_clock::now() + chrono::milliseconds(config.moveTimeMs));
+    }
+    std::vector<EngineInfo> lines;
+    if (isMinimax(config)) {
+        if (!state.tt) {
+            state.tt.reset(new TranspositionTable(config.ttEntries));
+        }
+        vector<vector<int>> b = toMinimaxBoard(board, toMove);
+        unsigned int empty = (unsigned int)std::count(board.begin(), board.end(), EMPTY);
+        std::vector<int> columns;
+        for (int col = 0; col < BOARD_WIDTH; col++) {
+            if (findFirstEmptyRow(board, col) != -1) columns.push_back(col);
+        }
+        // Per column, so each line carries its own node count
+        SearchState states[BOARD_WIDTH];
+        for (int i = 0; i < (int)columns.size(); i++) {
+            states[i].tt = state.tt.get();
+            states[i].deadline = deadline;
+            states[i].deterministic = (config.seed != 0);
+            states[i].cancel = control ? &control->stop : nullptr;
+        }
+        for (unsigned int d = 1; d <= min(empty, config.depth) && depthAllowed(control, d); d++) {
+            std::vector<EngineInfo> depthLines(columns.size());
+            TaskGroup group;
+            for (int i = 0; i < (int)columns.size(); i++) {
+                searchScheduler().spawn(group, [&, i, d]() {
+                    vector<vector<int>> child = copyBoard(b);
+                    makeMove(child, columns[i], AI);
+                    SearchState* s = &states[i];
+                    array<int, 2> reply = (config.search == SEARCH_PVS) ? miniMaxPVS(child, d - 1, 0 - INT_MAX, INT_MAX, PLAYER, s)
+                                        : (config.kind == ENGINE_MINIMAX_PARALLEL) ? miniMaxParallel(child, d - 1, 0 - INT_MAX, INT_MAX, PLAYER, s)
+                                        : miniMax(child, d - 1, 0 - INT_MAX, INT_MAX, PLAYER, s);
+                    depthLines[i].depth = d;
+                    depthLines[i].score = reply[0];
+                    depthLines[i].nodes = s->nodes.load();
+                    depthLines[i].pv = minimaxPV(s->tt, b, columns[i], d);
+                });
+            }
+            searchScheduler().wait(group);
+            bool stopped = false;
+            for (int i = 0; i < (int)columns.size(); i++) {
+                stopped = stopped || states[i].stop.load();
+            }
+            if (stopped) {
+                break;
+            }
+            lines = depthLines;
+            stable_sort(lines.begin(), lines.end(), [](const EngineInfo& x, const EngineInfo& y) { return x.score > y.score; });
+            for (size_t i = 0; i < lines.size(); i++) {
+                lines[i].rank = i + 1;
+                if (control && control->info) control->info(lines[i]);
+            }
+        }
+        return lines;
+    }
+    EngineConfig equalShares = config;
+    equalShares.kind = ENGINE_MCTS_PARALLEL_2;
+    searchMcts(equalShares, state, moves, board, toMove, deadline, control);
+    // A symmetric root only has children in its distinct columns, the others mirror them
+    int last = lastDistinctColumn(board);
+    for (int col = 0; col < BOARD_WIDTH; col++) {
+        int distinct = (col > last) ? BOARD_WIDTH - 1 - col : col;
+        const Node* child = state.root->children[distinct];
+        if (child == nullptr || findFirstEmptyRow(board, col) == -1) continue;
+        EngineInfo line = mctsInfo(child, child->visit_count);
+        line.pv.insert(line.pv.begin(), distinct);
+        if (distinct != col) {
+            for (int& c : line.pv) c = BOARD_WIDTH - 1 - c;
+        }
+        line.depth = line.pv.size();
+        line.score = child->visit_count > 0 ? (int)std::lround(1000 * child->total_reward / child->visit_count) : 0;
+        lines.push_back(line);
+    }
+    stable_sort(lines.begin(), lines.end(), [](const EngineInfo& x, const EngineInfo& y) { return x.score > y.score; });
+    for (size_t i = 0; i < lines.size(); i++) {
+        lines[i].rank = i + 1;
+        if (control && control->info) control->info(lines[i]);
+    }
+    return lines;
+}
+
+#endif
@@ -0,0 +1,228 @@
+// Perft for Connect 4: enumerates every move sequence to a given depth,
+// stopping at won games, and counts positions, wins and draws per ply with
+// the enumeration speed. Games are played on a bitboard.
+//
+// With --check every visited position is also built in the layouts of both
+// engines, and each board kernel is compared with its cell-by-cell reference
+// and with the bitboard:
+//   winningMove / winningMoveScan, checkWin / checkWinScan and alignment,
+//   isWinningMove on the parent, boardFull / checkDraw / full, tabScore /
+//   tabScoreScan and countWinningLines / countWinningLinesScan for both sides.
+// Afterwards each kernel and its reference are timed over a sample of the
+// visited positions, so a faster kernel comes with a speed number and with
+// its agreement on every position of the enumeration.
+//
+// Build: g++ -O2 -mavx2 -mfma -pthread connect4_perft.cpp -o connect4_perft
+// Run:   ./connect4_perft 8
+//        ./connect4_perft --check --sample 65536 7 33
+#include "connect4_engines.h"
+
+struct PerftConfig {
+    int depth = 0;
+    string moves = "-";
+    bool check = false;
+    size_t sample = 1 << 14;
+};
+
+struct PlyStats {
+    uint64_t nodes = 0;
+    uint64_t wins = 0;
+    uint64_t draws = 0;
+};
+
+// A kernel compared with its reference, with the first position it got wrong
+struct KernelCheck {
+    explicit KernelCheck(const char* name) : name(name) {}
+
+    const char* name;
+    uint64_t checked = 0;
+    uint64_t mismatches = 0;
+    string first;
+};
+
+enum CheckKind { CHECK_WIN_ROWS, CHECK_WIN_CELLS, CHECK_ALIGNMENT, CHECK_WINNING_MOVE, CHECK_DRAW, CHECK_TAB_SCORE,
+                 CHECK_WINNING_LINES, NUM_CHECKS };
+
+PerftConfig perft;
+vector<PlyStats> plies;
+KernelCheck checks[NUM_CHECKS] = {
+    KernelCheck("winningMove vs winningMoveScan"),
+    KernelCheck("checkWin vs checkWinScan"),
+    KernelCheck("alignment vs checkWinScan"),
+    KernelCheck("isWinningMove vs child"),
+    KernelCheck("boardFull / checkDraw vs full"),
+    KernelCheck("tabScore vs tabScoreScan"),
+    KernelCheck("countWinningLines vs Scan"),
+};
+
+// Both engines' layouts of the position being visited, kept in step with the bitboard
+vector<vector<int>> rows;
+std::vector<int> cells;
+string path;
+
+// Visited positions the kernels are timed on
+vector<vector<vector<int>>> sampleRows;
+vector<std::vector<int>> sampleCells;
+
+void expect(CheckKind kind, bool ok) {
+    KernelCheck& c = checks[kind];
+    c.checked++;
+    if (!ok && c.mismatches++ == 0) {
+        c.first = path.empty() ? "-" : path;
+    }
+}
+
+// Every kernel on the position just reached; mover is PLAYER1 (1) or PLAYER2 (2)
+// in both layouts, b the bitboard with the other side to move
+void checkKernels(const BitBoard& b, int mover, bool won) {
+    for (int p = 1; p <= 2; p++) {
+        bool reference = checkWinScan(cells, p);
+        expect(CHECK_WIN_ROWS, winningMove(rows, p) == winningMoveScan(rows, p) && winningMove(rows, p) == reference);
+        expect(CHECK_WIN_CELLS, checkWin(cells, p) == reference);
+        expect(CHECK_TAB_SCORE, tabScore(rows, p) == tabScoreScan(rows, p));
+        expect(CHECK_WINNING_LINES, countWinningLines(cells, p) == countWinningLinesScan(cells, p));
+    }
+    expect(CHECK_ALIGNMENT, BitBoard::alignment(b.current ^ b.mask) == checkWinScan(cells, mover) &&
+                            BitBoard::alignment(b.current) == checkWinScan(cells, 3 - mover));
+    expect(CHECK_WINNING_MOVE, won == checkWinScan(cells, mover));
+    expect(CHECK_DRAW, boardFull(rows) == checkDraw(cells) && checkDraw(cells) == b.full());
+    if (sampleCells.size() < perft.sample) {
+        sampleRows.push_back(rows);
+        sampleCells.push_back(cells);
+    }
+}
+
+void play(BitBoard& b, int col, int mover) {
+    int height = popcount(b.mask & BitBoard::column(col));
+    rows[height][col] = mover;
+    cells[(BOARD_HEIGHT - 1 - height) * BOARD_WIDTH + col] = mover;
+    b.play(col);
+    path.push_back((char)('0' + col));
+}
+
+void undo(const BitBoard& before, int col) {
+    int height = popcount(before.mask & BitBoard::column(col));
+    rows[height][col] = 0;
+    cells[(BOARD_HEIGHT - 1 - height) * BOARD_WIDTH + col] = EMPTY;
+    path.pop_back();
+}
+
+void enumerate(const BitBoard& b, int ply, int mover) {
+    for (int col = 0; col < BitBoard::WIDTH; col++) {
+        if (!b.canPlay(col)) continue;
+        bool won = b.isWinningMove(col);
+        BitBoard child = b;
+        play(child, col, mover);
+        PlyStats& stats = plies[ply + 1];
+        stats.nodes++;
+        if (won) {
+            stats.wins++;
+        } else if (child.full()) {
+            stats.draws++;
+        }
+        if (perft.check) {
+            checkKernels(child, mover, won);
+        }
+        if (!won && !child.full() && ply + 1 < perft.depth) {
+            enumerate(child, ply + 1, 3 - mover);
+        }
+        undo(b, col);
+    }
+}
+
+// Mean time of f over the sample, in nanoseconds
+template <typename F>
+double nsPerCall(F f) {
+    const int rounds = 8;
+    volatile int64_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < sampleCells.size(); i++) {
+            sink = sink + f(i);
+        }
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    return ns / (rounds * max<size_t>(1, sampleCells.size()));
+}
+
+void reportKernelSpeed() {
+    cout << "Kernel times over " << sampleCells.size() << " positions (ns/call):" << endl;
+    auto line = [](const char* kernel, double fast, const char* reference, double slow) {
+        cout << "  " << left << setw(20) << kernel << right << setw(8) << fixed << setprecision(1) << fast << "   "
+             << left << setw(22) << reference << right << setw(8) << slow << "   x" << setprecision(1)
+             << (fast > 0 ? slow / fast : 0) << endl;
+    };
+    line("winningMove", nsPerCall([](size_t i) { return (int64_t)winningMove(sampleRows[i], 1); }),
+         "winningMoveScan", nsPerCall([](size_t i) { return (int64_t)winningMoveScan(sampleRows[i], 1); }));
+    line("checkWin", nsPerCall([](size_t i) { return (int64_t)checkWin(sampleCells[i], 1); }),
+         "checkWinScan", nsPerCall([](size_t i) { return (int64_t)checkWinScan(sampleCells[i], 1); }));
+    line("tabScore", nsPerCall([](size_t i) { return (int64_t)tabScore(sampleRows[i], AI); }),
+         "tabScoreScan", nsPerCall([](size_t i) { return (int64_t)tabScoreScan(sampleRows[i], AI); }));
+    line("countWinningLines", nsPerCall([](size_t i) { return (int64_t)countWinningLines(sampleCells[i], 1); }),
+         "countWinningLinesScan", nsPerCall([](size_t i) { return (int64_t)countWinningLinesScan(sampleCells[i], 1); }));
+}
+
+int main(int argc, char** argv) {
+    vector<string> positional;
+    for (int i = 1; i < argc; i++) {
+        string flag = argv[i];
+        if (flag == "--check") { perft.check = true; }
+        else if (flag == "--sample" && i + 1 < argc) { perft.sample = strtoull(argv[++i], nullptr, 10); }
+        else { positional.push_back(flag); }
+    }
+    std::vector<int> board;
+    int toMove;
+    bool finished;
+    if (!positional.empty()) {
+        perft.depth = atoi(positional[0].c_str());
+    }
+    if (positional.size() >= 2) {
+        perft.moves = positional[1];
+    }
+    if (positional.empty() || positional.size() > 2 || perft.depth <= 0 ||
+        !replayMoves(perft.moves, board, toMove, finished) || finished) {
+        cout << "Usage: " << argv[0] << " [--check] [--sample N] depth [moves]" << endl;
+        return 1;
+    }
+    // Start from the moves given, in every representation
+    BitBoard b = bitBoardFromCells(board, toMove);
+    cells = board;
+    rows = toMinimaxBoard(board, PLAYER1);
+    for (auto& row : rows) {
+        for (int& cell : row) {
+            cell = ((unsigned int)cell == AI) ? PLAYER1 : ((unsigned int)cell == PLAYER) ? PLAYER2 : 0;
+        }
+    }
+    path = (perft.moves == "-") ? "" : perft.moves;
+    plies.assign(perft.depth + 1, PlyStats());
+
+    auto start = chrono::steady_clock::now();
+    enumerate(b, 0, toMove);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t total = 0;
+    cout << setw(5) << "ply" << setw(16) << "nodes" << setw(14) << "wins" << setw(12) << "draws" << endl;
+    for (int ply = 1; ply <= perft.depth; ply++) {
+        cout << setw(5) << ply << setw(16) << plies[ply].nodes << setw(14) << plies[ply].wins << setw(12)
+             << plies[ply].draws << endl;
+        total += plies[ply].nodes;
+    }
+    cout << "Total " << total << " nodes in " << fixed << setprecision(2) << seconds << " s (" << setprecision(1)
+         << (seconds > 0 ? total / seconds / 1e6 : 0) << " Mnodes/s" << (perft.check ? ", with checks" : "") << ")"
+         << endl;
+    if (!perft.check) {
+        return 0;
+    }
+    bool agree = true;
+    for (const KernelCheck& c : checks) {
+        cout << "  " << left << setw(32) << c.name << right << setw(12) << c.checked << " checked, " << c.mismatches
+             << " mismatches";
+        if (c.mismatches > 0) {
+            cout << " (first after moves " << c.first << ")";
+            agree = false;
+        }
+        cout << endl;
+    }
+    reportKernelSpeed();
+    return agree ? 0 : 2;
+}
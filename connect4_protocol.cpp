@@ -0,0 +1,298 @@
+// Line-based engine protocol on stdin/stdout for front-ends that drive
+// either engine. Searches run on their own thread, so commands keep being
+// read while one is in progress and stop ends it within milliseconds.
+//
+// Build: g++ -O2 -mavx2 -mfma -pthread connect4_protocol.cpp -o connect4_protocol
+// Run:   ./connect4_protocol --engine mcts:sims=1000000
+// Search threads default to CONNECT4_THREADS, else one per physical core;
+// --threads overrides it, and --pin 0/1 whether workers are pinned.
+//
+// Commands, one per line:
+//   engine <spec>        engine for the following searches, as accepted by parseEngineConfig
+//   newgame              forget the transposition table and search tree of the previous game
+//   position <moves>     columns played from the empty board ("-" for none)
+//   go [ms N] [depth N] [sims N] [infinite] [ponder] [multipv]
+//                        search the position; the limits override the spec's for this search.
+//                        multipv scores every column (engineAnalyze) and reports them ranked.
+//   stop                 end the search, which then reports its best move
+//   ponderhit            the predicted move was played: a go ponder search continues as a
+//                        normal one under the go line's limits, else the engine spec's,
+//                        with the ms limit counted from now
+//   isready              answered with readyok
+//   quit
+// Replies:
+//   info [multipv R] depth D nodes N nps X score S pv C C ...
+//   bestmove C
+//   readyok | error <reason>
+// Scores are the engine's own: the minimax evaluation for the side to move,
+// or the MCTS value of the first move in thousandths. A go infinite or go
+// ponder search holds its bestmove until stop or ponderhit.
+#include "connect4_engines.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+mutex outputLock;
+
+void send(const string& line) {
+    lock_guard<mutex> guard(outputLock);
+    cout << line << endl;
+}
+
+struct GoLimits {
+    long ms = 0;
+    bool infinite = false;
+    bool ponder = false;
+    bool multipv = false;
+    // Limits a ponder search takes on at ponderhit
+    unsigned int depth = 0;
+    int simulations = 0;
+};
+
+// The search in progress and the thread running it
+class SearchThread {
+public:
+    ~SearchThread() { finish(); }
+
+    bool running() const { return thread.joinable() && !reported; }
+
+    void start(const EngineConfig& config, EngineState& state, const string& moves, const GoLimits& limits) {
+        finish();
+        control.reset(new EngineControl());
+        done = false;
+        reported = false;
+        holding = limits.infinite || limits.ponder;
+        pondering = limits.ponder;
+        moveTimeMs = limits.ms;
+        ponderDepth = limits.depth;
+        ponderSimulations = limits.simulations;
+        reachedDepth = 0;
+        auto start = chrono::steady_clock::now();
+        control->info = [this, start](const EngineInfo& info) {
+            reachedDepth = max<unsigned int>(reachedDepth, info.depth);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            ostringstream line;
+            line << "info";
+            if (info.rank > 0) {
+                line << " multipv " << info.rank;
+            }
+            line << " depth " << info.depth << " nodes " << info.nodes << " nps "
+                 << (uint64_t)(seconds > 0 ? info.nodes / seconds : 0) << " score " << info.score << " pv";
+            for (int col : info.pv) {
+                line << " " << col;
+            }
+            send(line.str());
+        };
+        auto deadline = (limits.ms > 0 && !limits.ponder) ? start + chrono::milliseconds(limits.ms)
+                                                          : chrono::steady_clock::time_point::max();
+        bool multipv = limits.multipv;
+        thread = std::thread([this, config, &state, moves, deadline, multipv]() {
+            EngineResult result;
+            if (multipv) {
+                std::vector<EngineInfo> lines = engineAnalyze(config, state, moves, deadline, control.get());
+                std::vector<int> board;
+                int toMove;
+                bool finished;
+                replayMoves(moves, board, toMove, finished);
+                result.column = lines.empty() ? firstLegalColumn(board) : lines[0].pv[0];
+            } else {
+                result = engineSearch(config, state, moves, deadline, control.get());
+            }
+            unique_lock<mutex> guard(lock);
+            done = true;
+            changed.notify_all();
+            changed.wait(guard, [this] { return !holding; });
+            send("bestmove " + to_string(result.column));
+            reported = true;
+        });
+    }
+
+    void stop() {
+        if (!running()) {
+            return;
+        }
+        control->stop = true;
+        release();
+    }
+
+    // The ponder search becomes a normal one: its bestmove is no longer
+    // held, it takes on the depth and simulation limits, and its time limit
+    // starts now. A minimax search already past its depth ends at once, an
+    // MCTS search past its simulations at the end of its slice.
+    void ponderhit() {
+        lock_guard<mutex> guard(lock);
+        if (!running() || !pondering) {
+            return;
+        }
+        pondering = false;
+        holding = false;
+        changed.notify_all();
+        control->maxDepth = ponderDepth;
+        control->maxSimulations = ponderSimulations;
+        if (ponderDepth > 0 && reachedDepth >= ponderDepth) {
+            control->stop = true;
+        }
+        if (moveTimeMs > 0 && !done) {
+            auto deadline = chrono::steady_clock::now() + chrono::milliseconds(moveTimeMs);
+            timer = std::thread([this, deadline]() {
+                unique_lock<mutex> guard(lock);
+                if (!changed.wait_until(guard, deadline, [this] { return done; })) {
+                    control->stop = true;
+                }
+            });
+        }
+    }
+
+    // Waits for the search to end and report its move
+    void finish() {
+        if (thread.joinable()) {
+            thread.join();
+        }
+        if (timer.joinable()) {
+            timer.join();
+        }
+    }
+
+private:
+    void release() {
+        lock_guard<mutex> guard(lock);
+        holding = false;
+        pondering = false;
+        changed.notify_all();
+    }
+
+    unique_ptr<EngineControl> control;
+    std::thread thread;
+    std::thread timer;
+    mutex lock;
+    condition_variable changed;
+    bool done = false;
+    atomic<bool> reported{false};
+    bool holding = false;    // bestmove waits for stop or ponderhit
+    bool pondering = false;
+    long moveTimeMs = 0;
+    unsigned int ponderDepth = 0;
+    int ponderSimulations = 0;
+    atomic<unsigned int> reachedDepth{0};  // deepest minimax iteration reported so far
+};
+
+int main(int argc, char** argv) {
+    string spec = "minimax";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        istringstream value(argv[i + 1]);
+        if (flag == "--engine") { value >> spec; }
+        else if (flag == "--threads") { value >> SEARCH_THREADS; }
+        else if (flag == "--pin") { value >> PIN_THREADS; }
+        else if (flag == "--endgame") {
+            if (!endgameDB.open(argv[i + 1])) { cout << "Could not load endgame database " << argv[i + 1] << endl; return 1; }
+        }
+        else if (flag == "--cache") {
+            if (!analysisCache.open(argv[i + 1])) { cout << "Could not open analysis cache " << argv[i + 1] << endl; return 1; }
+        }
+        else if (flag == "--value-net") {
+            if (!valueNet.load(argv[i + 1])) { cout << "Could not load value net " << argv[i + 1] << endl; return 1; }
+        }
+        else { cout << "Unknown option " << flag << endl; return 1; }
+    }
+    EngineConfig engine;
+    if (!parseEngineConfig(spec, engine) || (argc - 1) % 2 != 0) {
+        cout << "Usage: " << argv[0] << " [--engine SPEC] [--threads N] [--pin 0|1] [--endgame FILE] [--cache FILE] [--value-net FILE]"
+             << endl;
+        return 1;
+    }
+    SEARCH_THREADS = max(1u, SEARCH_THREADS);
+    unique_ptr<EngineState> state(new EngineState());
+    string moves = "-";
+    SearchThread search;
+    string line;
+    while (getline(cin, line)) {
+        istringstream words(line);
+        string command;
+        words >> command;
+        bool busy = false;
+        if (search.running()) {
+            if (command == "stop") { search.stop(); search.finish(); continue; }
+            if (command == "ponderhit") { search.ponderhit(); continue; }
+            if (command == "isready") { send("readyok"); continue; }
+            if (command == "quit") { break; }
+            busy = true;
+        }
+        if (command.empty() || command == "stop" || command == "ponderhit") {
+            continue;
+        }
+        if (busy) {
+            send("error searching, stop first");
+        } else if (command == "isready") {
+            send("readyok");
+        } else if (command == "quit") {
+            break;
+        } else if (command == "engine") {
+            EngineConfig parsed;
+            string next;
+            words >> next;
+            if (!parseEngineConfig(next, parsed)) {
+                send("error unknown engine " + next);
+            } else {
+                engine = parsed;
+                state.reset(new EngineState());
+            }
+        } else if (command == "newgame") {
+            state.reset(new EngineState());
+        } else if (command == "position") {
+            string next;
+            std::vector<int> board;
+            int toMove;
+            bool finished;
+            words >> next;
+            if (next.empty() || !replayMoves(next, board, toMove, finished)) {
+                send("error illegal position");
+            } else {
+                moves = next;
+            }
+        } else if (command == "go") {
+            EngineConfig config = engine;
+            GoLimits limits;
+            string key;
+            while (words >> key) {
+                if (key == "ms") { words >> limits.ms; }
+                else if (key == "depth") { words >> config.depth; }
+                else if (key == "sims") { words >> config.simulations; }
+                else if (key == "infinite") { limits.infinite = true; }
+                else if (key == "ponder") { limits.ponder = true; }
+                else if (key == "multipv") { limits.multipv = true; }
+            }
+            if (limits.ponder) {
+                // Kept for ponderhit, after which the search runs as a normal one
+                limits.ms = limits.ms > 0 ? limits.ms : config.moveTimeMs;
+                if (isMinimax(config)) {
+                    limits.depth = config.depth;
+                } else {
+                    limits.simulations = config.simulations;
+                }
+            }
+            if (limits.ms > 0 || limits.infinite || limits.ponder) {
+                config.moveTimeMs = 0;  // the protocol's limits replace the spec's own time budget
+            }
+            if (limits.infinite || limits.ponder) {
+                config.simulations = INT_MAX;
+                config.depth = NUM_ROW * NUM_COL;
+            }
+            std::vector<int> board;
+            int toMove;
+            bool finished;
+            replayMoves(moves, board, toMove, finished);
+            if (finished) {
+                send("error position is finished");
+            } else {
+                search.start(config, *state, moves, limits);
+            }
+        } else {
+            send("error unknown command " + command);
+        }
+    }
+    search.stop();
+    search.finish();
+    return 0;
+}
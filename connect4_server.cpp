@@ -0,0 +1,281 @@
+// Multi-game engine server. Serves both the minimax and the MCTS engine to
+// many concurrent games over a UNIX domain socket or TCP on localhost.
+//
+// Build: g++ -O2 -mavx2 -mfma -pthread connect4_server.cpp -o connect4_server
+// Run:   ./connect4_server --unix /tmp/connect4.sock   or   ./connect4_server --tcp 7777
+//
+// Protocol, one request per line and one reply per line:
+//   move <game> <engine> <budget-ms> <moves>  ->  bestmove <game> <column> | busy | error <reason>
+//   end <game>                                ->  ok
+// <engine> is a spec as accepted by parseEngineConfig, e.g. "minimax" or
+// "mcts:sims=5000". <moves> is the sequence of columns played from the empty
+// board ("-" for none). "busy" means the work queue is full and the client
+// should retry.
+#include "connect4_engines.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+
+struct ServerConfig {
+    string unixPath;
+    int tcpPort = -1;
+    unsigned int workers = max(1u, thread::hardware_concurrency());
+    size_t queueCapacity = 0;
+    size_t maxGames = 1024;
+    EngineConfig engineDefaults;
+};
+
+ServerConfig config;
+
+// Everything a game keeps resident between its moves. Only one search per
+// game runs at a time, guarded by lock.
+struct Game {
+    mutex lock;
+    string spec;
+    EngineConfig engine;
+    EngineState state;
+    chrono::steady_clock::time_point lastUsed;
+};
+
+struct Job {
+    shared_ptr<Game> game;
+    string id;
+    string moves;
+    chrono::steady_clock::time_point deadline;
+    promise<string> reply;
+};
+
+// Bounded FIFO between connection threads and the worker pool. tryPush fails
+// instead of blocking so that overload turns into an immediate "busy" reply.
+class JobQueue {
+public:
+    explicit JobQueue(size_t capacity) : capacity(capacity) {}
+
+    bool tryPush(unique_ptr<Job>& job) {
+        lock_guard<mutex> guard(lock);
+        if (jobs.size() >= capacity) {
+            return false;
+        }
+        jobs.push_back(move(job));
+        ready.notify_one();
+        return true;
+    }
+
+    unique_ptr<Job> pop() {
+        unique_lock<mutex> guard(lock);
+        ready.wait(guard, [this] { return !jobs.empty(); });
+        unique_ptr<Job> job = move(jobs.front());
+        jobs.pop_front();
+        return job;
+    }
+
+private:
+    size_t capacity;
+    mutex lock;
+    condition_variable ready;
+    deque<unique_ptr<Job>> jobs;
+};
+
+mutex gamesLock;
+unordered_map<string, shared_ptr<Game>> games;
+
+// Returns the resident game, creating it and evicting the least recently
+// used idle game when the table is full. A game switching engine starts over.
+shared_ptr<Game> findGame(const string& id, const string& spec, const EngineConfig& engine) {
+    lock_guard<mutex> guard(gamesLock);
+    auto it = games.find(id);
+    if (it != games.end() && it->second->spec == spec) {
+        return it->second;
+    }
+    if (it == games.end() && games.size() >= config.maxGames) {
+        auto oldest = games.end();
+        for (auto g = games.begin(); g != games.end(); ++g) {
+            if (g->second.use_count() == 1 && (oldest == games.end() || g->second->lastUsed < oldest->second->lastUsed)) {
+                oldest = g;
+            }
+        }
+        if (oldest == games.end()) {
+            return nullptr;
+        }
+        games.erase(oldest);
+    }
+    shared_ptr<Game> game = make_shared<Game>();
+    game->spec = spec;
+    game->engine = engine;
+    games[id] = game;
+    return game;
+}
+
+void worker(JobQueue& queue) {
+    while (true) {
+        unique_ptr<Job> job = queue.pop();
+        std::vector<int> board;
+        int toMove;
+        bool finished;
+        if (!replayMoves(job->moves, board, toMove, finished) || finished) {
+            job->reply.set_value("error illegal or finished position");
+            continue;
+        }
+        EngineResult result;
+        {
+            lock_guard<mutex> guard(job->game->lock);
+            job->game->lastUsed = chrono::steady_clock::now();
+            result = engineSearch(job->game->engine, job->game->state, job->moves, job->deadline);
+        }
+        job->reply.set_value("bestmove " + job->id + " " + to_string(result.column));
+    }
+}
+
+string handleRequest(const string& line, JobQueue& queue) {
+    istringstream in(line);
+    string command, id;
+    in >> command >> id;
+    if (command == "end" && !id.empty()) {
+        lock_guard<mutex> guard(gamesLock);
+        games.erase(id);
+        return "ok";
+    }
+    if (command != "move" || id.empty()) {
+        return "error unknown request";
+    }
+    string spec, moves;
+    long budget = -1;
+    in >> spec >> budget >> moves;
+    EngineConfig engine = config.engineDefaults;
+    if (!parseEngineConfig(spec, engine) || budget < 0 || moves.empty()) {
+        return "error expected: move <game> <engine> <budget-ms> <moves>";
+    }
+    shared_ptr<Game> game = findGame(id, spec, engine);
+    if (game == nullptr) {
+        return "busy";
+    }
+    unique_ptr<Job> job(new Job());
+    job->game = game;
+    job->id = id;
+    job->moves = moves;
+    job->deadline = chrono::steady_clock::now() + chrono::milliseconds(budget);
+    future<string> reply = job->reply.get_future();
+    if (!queue.tryPush(job)) {
+        return "busy";
+    }
+    return reply.get();
+}
+
+void serveConnection(int fd, JobQueue& queue) {
+    string pending;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        pending.append(buffer, n);
+        size_t eol;
+        while ((eol = pending.find('\n')) != string::npos) {
+            string line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            string reply = handleRequest(line, queue) + "\n";
+            if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) {
+                close(fd);
+                return;
+            }
+        }
+    }
+    close(fd);
+}
+
+int listenSocket() {
+    if (!config.unixPath.empty()) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, config.unixPath.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(config.unixPath.c_str());
+        if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+            perror("unix socket");
+            return -1;
+        }
+        return fd;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.tcpPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        perror("tcp socket");
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        istringstream value(argv[i + 1]);
+        if (flag == "--unix") { value >> config.unixPath; }
+        else if (flag == "--tcp") { value >> config.tcpPort; }
+        else if (flag == "--workers") { value >> config.workers; }
+        else if (flag == "--queue") { value >> config.queueCapacity; }
+        else if (flag == "--max-games") { value >> config.maxGames; }
+        else if (flag == "--tt-entries") { value >> config.engineDefaults.ttEntries; }
+        else if (flag == "--simulations") { value >> config.engineDefaults.simulations; }
+        else if (flag == "--max-depth") { value >> config.engineDefaults.depth; }
+        else if (flag == "--endgame") {
+            if (!endgameDB.open(argv[i + 1])) { cout << "Could not load endgame database " << argv[i + 1] << endl; return 1; }
+        }
+        else if (flag == "--cache") {
+            if (!analysisCache.open(argv[i + 1])) { cout << "Could not open analysis cache " << argv[i + 1] << endl; return 1; }
+        }
+        else if (flag == "--value-net") {
+            if (!valueNet.load(argv[i + 1])) { cout << "Could not load value net " << argv[i + 1] << endl; return 1; }
+        }
+        else { cout << "Unknown option " << flag << endl; return 1; }
+    }
+    if (config.unixPath.empty() && config.tcpPort < 0) {
+        cout << "Usage: " << argv[0] << " (--unix PATH | --tcp PORT) [--workers N] [--queue N] [--max-games N]"
+             << " [--tt-entries N] [--simulations N] [--max-depth N] [--endgame FILE] [--cache FILE] [--value-net FILE]" << endl;
+        return 1;
+    }
+    config.workers = max(1u, config.workers);
+    if (config.queueCapacity == 0) {
+        config.queueCapacity = 2 * config.workers;
+    }
+    // Parallelism comes from running many games at once, so every search
+    // runs its scheduler tasks inline on its own worker thread
+    SEARCH_THREADS = 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    int listenFd = listenSocket();
+    if (listenFd < 0) {
+        return 1;
+    }
+    JobQueue queue(config.queueCapacity);
+    for (unsigned int i = 0; i < config.workers; i++) {
+        thread(worker, ref(queue)).detach();
+    }
+    cout << "Serving with " << config.workers << " workers, queue capacity " << config.queueCapacity << endl;
+    while (true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        thread(serveConnection, fd, ref(queue)).detach();
+    }
+    return 0;
+}
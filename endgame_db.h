@@ -0,0 +1,161 @@
+// Endgame database: exact results for positions with few empty cells,
+// produced by endgame_gen.cpp and memory-mapped read-only by the engines.
+//
+// File layout: an EndgameHeader followed by `slots` 64-bit entries forming an
+// open-addressed hash table with linear probing (slots is a power of two).
+// Entry bits: 0-48 BitBoard::key(), 49-50 result + 1, 51-56 distance in
+// plies to the end of the game, 57-60 best column. An all-zero entry is empty.
+#ifndef CONNECT4_ENDGAME_DB_H
+#define CONNECT4_ENDGAME_DB_H
+
+#include "connect4_bitboard.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+const char ENDGAME_MAGIC[8] = {'C', '4', 'E', 'N', 'D', 'G', 'M', '1'};
+
+struct EndgameHeader {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t maxEmpty;
+    uint32_t reserved;
+    uint64_t slots;
+    uint64_t count;
+};
+
+// result is from the side to move: 1 win, 0 draw, -1 loss
+struct EndgameEntry {
+    int result;
+    int distance;
+    int move;
+};
+
+inline uint64_t packEndgameEntry(uint64_t key, const EndgameEntry& e) {
+    return key | ((uint64_t)(e.result + 1) << 49) | ((uint64_t)e.distance << 51) | ((uint64_t)e.move << 57);
+}
+
+inline EndgameEntry unpackEndgameEntry(uint64_t packed) {
+    return EndgameEntry{(int)((packed >> 49) & 0x3) - 1, (int)((packed >> 51) & 0x3f), (int)((packed >> 57) & 0xf)};
+}
+
+// Keys come from a structured bit layout, so mix them before indexing
+inline uint64_t endgameSlot(uint64_t key, uint64_t slots) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key & (slots - 1);
+}
+
+class EndgameDB {
+public:
+    ~EndgameDB() { close(); }
+
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(EndgameHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        const EndgameHeader* header = (const EndgameHeader*)map;
+        if (memcmp(header->magic, ENDGAME_MAGIC, 8) != 0 || header->width != BitBoard::WIDTH ||
+            header->height != BitBoard::HEIGHT ||
+            (size_t)st.st_size != sizeof(EndgameHeader) + header->slots * sizeof(uint64_t)) {
+            munmap(map, st.st_size);
+            return false;
+        }
+        base = map;
+        length = st.st_size;
+        maxEmptyCells = header->maxEmpty;
+        slots = header->slots;
+        table = (const uint64_t*)(header + 1);
+        return true;
+    }
+
+    void close() {
+        if (base) {
+            munmap(base, length);
+        }
+        base = nullptr;
+        table = nullptr;
+        maxEmptyCells = 0;
+    }
+
+    bool loaded() const { return table != nullptr; }
+    int maxEmpty() const { return maxEmptyCells; }
+
+    bool probe(const BitBoard& b, EndgameEntry& entry) const {
+        if (!table || BitBoard::WIDTH * BitBoard::HEIGHT - b.moves > maxEmptyCells) {
+            return false;
+        }
+        uint64_t key = b.key();
+        for (uint64_t i = endgameSlot(key, slots);; i = (i + 1) & (slots - 1)) {
+            uint64_t packed = table[i];
+            if (packed == 0) {
+                return false;
+            }
+            if ((packed & ((1ULL << 49) - 1)) == key) {
+                entry = unpackEndgameEntry(packed);
+                return true;
+            }
+        }
+    }
+
+private:
+    void* base = nullptr;
+    size_t length = 0;
+    int maxEmptyCells = 0;
+    uint64_t slots = 0;
+    const uint64_t* table = nullptr;
+};
+
+// Writes solved positions (key -> packed entry) as a table at most half full
+inline bool writeEndgameDB(const char* path, int maxEmpty, const std::unordered_map<uint64_t, uint64_t>& solved) {
+    uint64_t slots = 1;
+    while (slots < 2 * solved.size() + 1) {
+        slots <<= 1;
+    }
+    std::vector<uint64_t> table(slots, 0);
+    for (const auto& kv : solved) {
+        uint64_t i = endgameSlot(kv.first, slots);
+        while (table[i] != 0) {
+            i = (i + 1) & (slots - 1);
+        }
+        table[i] = kv.second;
+    }
+    EndgameHeader header = {};
+    memcpy(header.magic, ENDGAME_MAGIC, 8);
+    header.width = BitBoard::WIDTH;
+    header.height = BitBoard::HEIGHT;
+    header.maxEmpty = maxEmpty;
+    header.slots = slots;
+    header.count = solved.size();
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(table.data(), sizeof(uint64_t), slots, out) == slots;
+    return fclose(out) == 0 && ok;
+}
+
+// Process-wide database the engines probe; empty until open() succeeds
+inline EndgameDB endgameDB;
+
+#endif
@@ -0,0 +1,98 @@
+// Exact alpha-beta solver for positions late in the game, for engines that
+// want a proven result where the endgame database has none. Negamax on the
+// bitboard with the threat masks of threat_search.h: moves that hand the
+// opponent an immediate win are never searched, the rest are tried in order
+// of the threats they create, and a transposition table keeps upper bounds.
+//
+// Scores count the stones left to the winner: a win with the side to move's
+// stone number n (counting every stone on the board) scores (W * H + 1 - n) / 2,
+// a loss the negative of the opponent's, a draw 0. solve() only asks whether
+// the score is above, at or below 0, which is much cheaper than the score.
+#ifndef CONNECT4_ENDGAME_SOLVER_H
+#define CONNECT4_ENDGAME_SOLVER_H
+
+#include "threat_search.h"
+
+#include <cstddef>
+#include <vector>
+
+class EndgameSolver {
+public:
+    static const int CELLS = BitBoard::WIDTH * BitBoard::HEIGHT;
+
+    explicit EndgameSolver(size_t entries = 1 << 18) : table(entries) {}
+
+    // 1 win, 0 draw, -1 loss for the side to move. b must not be won already.
+    int solve(const BitBoard& b) {
+        if (b.full()) {
+            return 0;
+        }
+        if (winningMoves(b)) {
+            return 1;
+        }
+        int score = negamax(b, -1, 1);
+        return (score > 0) - (score < 0);
+    }
+
+    uint64_t nodes = 0;  // positions searched since construction
+
+private:
+    static const int MIN_SCORE = -(CELLS / 2);
+
+    // Entries are key << 8 | (upper bound - MIN_SCORE + 1), 0 when empty
+    std::vector<uint64_t> table;
+
+    size_t slot(uint64_t key) const { return (key * 0x9e3779b97f4a7c15ULL >> 20) % table.size(); }
+
+    // Score of b within [alpha, beta] when the side to move cannot win at once
+    int negamax(const BitBoard& b, int alpha, int beta) {
+        nodes++;
+        BitBoard::Bits next = nonLosingMoves(b);
+        if (next == 0) {
+            return -(CELLS - b.moves) / 2;  // the opponent wins with its next stone
+        }
+        if (b.moves >= CELLS - 2) {
+            return 0;
+        }
+        int lowest = -(CELLS - 2 - b.moves) / 2;
+        if (alpha < lowest) {
+            alpha = lowest;
+            if (alpha >= beta) return alpha;
+        }
+        int highest = (CELLS - 1 - b.moves) / 2;
+        uint64_t key = b.key();
+        uint64_t entry = table[slot(key)];
+        if (entry != 0 && (entry >> 8) == key) {
+            highest = (int)(entry & 0xff) + MIN_SCORE - 1;
+        }
+        if (beta > highest) {
+            beta = highest;
+            if (alpha >= beta) return beta;
+        }
+        // Moves that create the most winning cells first, centre first on ties
+        int order[BitBoard::WIDTH], threats[BitBoard::WIDTH], count = 0;
+        for (int col : THREAT_ORDER) {
+            BitBoard::Bits move = next & BitBoard::column(col);
+            if (!move) continue;
+            int created = popcount(BitBoard::winningCells(b.current | move, b.mask | move));
+            int i = count++;
+            for (; i > 0 && threats[i - 1] < created; i--) {
+                order[i] = order[i - 1];
+                threats[i] = threats[i - 1];
+            }
+            order[i] = col;
+            threats[i] = created;
+        }
+        for (int i = 0; i < count; i++) {
+            BitBoard child = b;
+            child.play(order[i]);
+            int score = -negamax(child, -beta, -alpha);
+            if (score >= beta) return score;
+            if (score > alpha) alpha = score;
+        }
+        table[slot(key)] = key << 8 | (uint64_t)(alpha - MIN_SCORE + 1);
+        return alpha;
+    }
+};
+
+#endif
@@ -3,9 +3,15 @@
 #include <algorithm>
 #include <random>
 #include <cmath>
-#include <omp.h>
+#include <mutex>
 #include <chrono>
 #include <iostream>
+#include "endgame_db.h"
+#include "analysis_cache.h"
+#include "task_scheduler.h"
+#include "value_net.h"
+#include "threat_search.h"
+#include "endgame_solver.h"
 
 const int BOARD_WIDTH = 7;
 const int BOARD_HEIGHT = 6;
@@ -13,8 +19,37 @@ const int EMPTY = 0;
 const int PLAYER1 = 1;
 const int PLAYER2 = 2;
 const double C_PUCT = 1.0;
+// Settings of the search running on this thread. Thread-local so that
+// engines with different settings can search side by side; scheduler tasks
+// take the settings of the thread that spawned them.
+struct MctsSettings {
+    double exploration_weight = C_PUCT;  // weight of the exploration term in selectChild
+    bool value_net = false;              // leaves from valueNet instead of random rollouts
+    bool heavy_playouts = false;         // rollouts by heavyRollout instead of uniformly random moves
+    bool priors = true;                  // PUCT with movePrior priors instead of plain UCT
+    size_t max_nodes = 0;                // node budget of the tree, 0 = unbounded
+    uint64_t seed = 0;                   // nonzero for reproducible searches, see simulationSeed
+    double rave_equivalence = 0;         // visits at which RAVE and the node's own value weigh the same, 0 = no RAVE
+    int solve_empty = 0;                 // nodes with at most this many empty cells are solved exactly, 0 = never
+};
+thread_local MctsSettings mcts_settings;
+// Playout moves on this thread. A search with mcts_settings.seed reseeds it
+// for every playout, so results do not depend on which thread ran which.
+thread_local std::minstd_rand mcts_rng;
 const int NUM_SIMULATIONS = 10000;
 const int NUM_ITERATIONS = 10000;
+const int LEAF_BATCH = 16;         // leaves mcts_batched evaluates together
+const double VIRTUAL_LOSS = 1.0;   // reward taken from a path while its leaf awaits evaluation
+const int8_t UNPROVEN = 2;         // Node::proven of a node not solved
+// Exact solver for the hybrid mode, with a transposition table per search thread
+thread_local EndgameSolver endgame_solver;
+
+// Stones each side placed during a playout, for the all-moves-as-first
+// statistics. A move counts as played later in the simulation when its cell
+// ends up holding a stone of the side that could have played it.
+struct PlayedStones {
+    BitBoard::Bits by[3] = {0, 0, 0};  // indexed by PLAYER1 / PLAYER2
+};
 
 class Node {
 public:
@@ -23,6 +58,16 @@ public:
     std::vector<Node*> children;
     int visit_count;
     double total_reward;
+    double prior = 1.0;  // movePrior of the move leading here, used by PUCT selection
+    // RAVE: simulations through the parent in which the same side played
+    // this node's move at any later point, and their reward in total_reward's terms
+    uint32_t amaf_visits = 0;
+    float amaf_reward = 0;
+    // Hybrid mode: the exact value in total_reward's terms once endgame_solver
+    // has solved the node, UNPROVEN before. A proven node is not expanded.
+    // Atomic because mcts_batched solves leaves outside its tree lock while
+    // selection reads it; threads solving one node at once store the same value.
+    std::atomic<int8_t> proven{UNPROVEN};
 
     Node(const std::vector<int>& board, int player);
     ~Node() {
@@ -34,8 +79,30 @@ public:
     }
     Node* selectChild();
     Node* expand(int action);
-    double rollout();
+    double rollout(PlayedStones* played = nullptr);
+    double heavyRollout(PlayedStones* played = nullptr);
+    bool exactValue(double& value);
+    double evaluate();
+    // The evaluators score for PLAYER1; total_reward is kept for the side
+    // that moved into the node, the side its parent's selection chooses for
+    double forMover(double player1_value) const { return (player == PLAYER2) ? player1_value : -player1_value; }
+    bool provenValue(double& reward);
+    // Solves the node first when the hybrid mode covers it. The searches
+    // leave proven nodes other than the root unexpanded.
+    bool isProven() {
+        double reward;
+        return provenValue(reward);
+    }
+    double leafValue(PlayedStones* played = nullptr) {
+        double reward;
+        if (provenValue(reward)) {
+            return reward;
+        }
+        return forMover(mcts_settings.value_net ? evaluate()
+                        : mcts_settings.heavy_playouts ? heavyRollout(played) : rollout(played));
+    }
     void backpropagate(double reward);
+    void updateRave(double reward, PlayedStones played, const Node* top = nullptr);
     void backpropagateParallel(double reward); // Parallel version of backpropagate
 
     Node* parent = nullptr;
@@ -44,35 +111,86 @@ public:
 int findFirstEmptyRow(const std::vector<int>& board, int column);
 bool checkWin(const std::vector<int>& board, int player);
 bool checkDraw(const std::vector<int>& board);
-std::vector<int> mcts(Node* root);
+int lastDistinctColumn(const std::vector<int>& board);
+double movePrior(const std::vector<int>& board, int action, int player);
+std::vector<int> mcts(Node* root, int num_simulations = NUM_SIMULATIONS,
+                      std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+                      const std::atomic<bool>* stop = nullptr);
+std::vector<int> mcts_parallel_1(Node* root, int num_simulations = NUM_SIMULATIONS,
+                                 std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+                                 const std::atomic<bool>* stop = nullptr);
+std::vector<int> mcts_parallel_2(Node* root, int num_simulations = NUM_SIMULATIONS,
+                                 std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+                                 const std::atomic<bool>* stop = nullptr);
+std::vector<int> mcts_batched(Node* root, int num_simulations = NUM_SIMULATIONS,
+                              std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max(),
+                              int batch_size = LEAF_BATCH, const std::atomic<bool>* stop = nullptr);
+size_t countNodes(const Node* node);
+size_t recycleTree(Node* root, size_t count);
 void printBoard(const std::vector<int>& board);
+int moveColumn(const std::vector<int>& before, const std::vector<int>& after);
+Node* advanceRoot(Node* root, int column);
+void seedRootFromCache(Node* root);
+void storeRootInCache(Node* root);
 
 Node::Node(const std::vector<int>& board, int player) : board(board), player(player), visit_count(0), total_reward(0) {
     children.resize(BOARD_WIDTH, nullptr);
 }
 
+// A child's value mixed with its RAVE value. The RAVE weight
+// sqrt(k / (3n + k)) for n visits and equivalence k starts at 1 and decays
+// as the child's own visits accumulate.
+double raveBlend(const Node* child, double value) {
+    double k = mcts_settings.rave_equivalence;
+    if (k <= 0 || child->amaf_visits == 0) {
+        return value;
+    }
+    double beta = std::sqrt(k / (3.0 * child->visit_count + k));
+    return (1 - beta) * value + beta * child->amaf_reward / child->amaf_visits;
+}
+
 Node* Node::selectChild() {
     Node* best_child = nullptr;
     double best_score = -std::numeric_limits<double>::infinity();
+    double prior_sum = 0.0;
+    if (mcts_settings.priors) {
+        for (Node* child : children) {
+            if (child != nullptr) prior_sum += child->prior;
+        }
+    }
 
     for (int i = 0; i < children.size(); i++) {
         if (children[i] == nullptr) continue;
 
-        double exploitation_score = 0.0;
-        if (children[i]->visit_count > 0) {
-            exploitation_score = children[i]->total_reward / children[i]->visit_count;
+        double score;
+        if (mcts_settings.priors) {
+            // PUCT: an unvisited child is ranked by its share of the prior alone
+            double exploitation_score = 0.0;
+            if (children[i]->visit_count > 0) {
+                exploitation_score = children[i]->total_reward / children[i]->visit_count;
+            }
+            exploitation_score = raveBlend(children[i], exploitation_score);
+            double exploration_score = children[i]->prior / prior_sum *
+                                       std::sqrt((double)std::max(1, visit_count)) / (1 + children[i]->visit_count);
+            score = exploitation_score + mcts_settings.exploration_weight * exploration_score;
         } else {
-            exploitation_score = 0.00001; // Assign a default value (or a small positive value)
-        }
+            double exploitation_score = 0.0;
+            if (children[i]->visit_count > 0) {
+                exploitation_score = children[i]->total_reward / children[i]->visit_count;
+            } else {
+                exploitation_score = 0.00001; // Assign a default value (or a small positive value)
+            }
+            exploitation_score = raveBlend(children[i], exploitation_score);
 
-        double exploration_score = 0.0;
-        if (children[i]->visit_count > 0) {
-            exploration_score = std::sqrt(2 * std::log(visit_count) / children[i]->visit_count);
-        } else {
-            exploration_score = 0.00001; // Assign a default value (or a small positive value)
-        }
+            double exploration_score = 0.0;
+            if (children[i]->visit_count > 0) {
+                exploration_score = std::sqrt(2 * std::log(visit_count) / children[i]->visit_count);
+            } else {
+                exploration_score = 0.00001; // Assign a default value (or a small positive value)
+            }
 
-        double score = exploitation_score + C_PUCT * exploration_score;
+            score = exploitation_score + mcts_settings.exploration_weight * exploration_score;
+        }
 
         if (score > best_score) {
             best_score = score;
@@ -90,10 +208,13 @@ Node* Node::expand(int action) {
     int new_player = (player == PLAYER1) ? PLAYER2 : PLAYER1;
     Node* child = new Node(new_board, new_player);
     child->parent = this;  // Set the parent of the child node
+    child->prior = movePrior(board, action, player);
     children[action] = child;
 
+    // The bonuses below run inside mcts_parallel_2's subtree tasks too,
+    // so they go up the parallel path, which locks the shared root
     if (checkWin(new_board, player)) {
-        backpropagate(1.0); 
+        backpropagateParallel(-1.0);
     } else {
         for (int dir : {-1, 0, 1}) { 
             int consecutive = 0;
@@ -117,11 +238,11 @@ Node* Node::expand(int action) {
                     }
                 }
                 if (consecutive == 3) {
-                    backpropagate(0.8); 
+                    backpropagateParallel(-0.8);
                     break;
                 }
                 if (consecutiveOpponent == 3) {
-                    backpropagate(-0.6); 
+                    backpropagateParallel(0.6);
                     break;
                 }
             }
@@ -130,83 +251,126 @@ Node* Node::expand(int action) {
     return child;
 }
 
-int evaluateImmediateWin(Node* node) {
-    if (checkWin(node->board, node->player)) {
-        return 1000; // Large score for winning move
-    } else if (checkWin(node->board, node->player == PLAYER1 ? PLAYER2 : PLAYER1)) {
-        return 1001; // Smaller score, but still significant, for blocking opponent win
-    }
-    return 0; // No immediate win or block
-}
-
-
-int bfsImmediateAnalysis(Node* root, int depth) {
-    struct Move {
-        Node* node;
-        int depth;
-        int column;  // Move that led to this node
-    };
-
-    std::queue<Move> queue;
-    Move bestMove = {nullptr, 0, -1};
-    int bestScore = std::numeric_limits<int>::min();
-
-    // Enqueue initial moves
-    for (int i = 0; i < BOARD_WIDTH; i++) {
-        if (findFirstEmptyRow(root->board, i) != -1) {
-            Node* child = root->expand(i);
-            queue.push({child, 1, i});
-        }
-    }
-
-    while (!queue.empty()) {
-        Move currentMove = queue.front();
-        queue.pop();
-
-        // Score this move
-        int score = evaluateImmediateWin(currentMove.node);
-        if (score > bestScore) {
-            bestScore = score;
-            bestMove = currentMove;
-        }
-
-        if (currentMove.depth < depth) {
-            for (int i = 0; i < BOARD_WIDTH; i++) {
-                if (findFirstEmptyRow(currentMove.node->board, i) != -1) {
-                    Node* child = currentMove.node->expand(i);
-                    queue.push({child, currentMove.depth + 1, currentMove.column});
-                }
-            }
-        }
-    }
-
-    while (!queue.empty()) {
-        delete queue.front().node;
-        queue.pop();
-    }
-
-    return bestMove.column;
-}
-
-
-double Node::rollout() {
+double Node::rollout(PlayedStones* played) {
     std::vector<int> state(board);
     int player = this->player;
+    int empty = std::count(state.begin(), state.end(), EMPTY);
 
     while (true) {
         if (checkWin(state, PLAYER1)) return 1.0;
         if (checkWin(state, PLAYER2)) return -1.0;
         if (checkDraw(state)) return 0.0;
 
+        // Once the playout reaches a solved endgame, its exact result replaces the rest of it
+        EndgameEntry entry;
+        if (endgameDB.loaded() && empty <= endgameDB.maxEmpty() &&
+            endgameDB.probe(bitBoardFromCells(state, player), entry)) {
+            if (entry.result == 0) return 0.0;
+            int winner = (entry.result > 0) ? player : ((player == PLAYER1) ? PLAYER2 : PLAYER1);
+            return (winner == PLAYER1) ? 1.0 : -1.0;
+        }
+
         std::vector<int> available_moves;
         for (int i = 0; i < BOARD_WIDTH; i++) {
             if (findFirstEmptyRow(state, i) != -1) available_moves.push_back(i);
         }
-        int action = available_moves[std::rand() % available_moves.size()];
+        int action = available_moves[mcts_rng() % available_moves.size()];
         int row = findFirstEmptyRow(state, action);
         state[row * BOARD_WIDTH + action] = player;
+        if (played) played->by[player] |= BitBoard::cell(action, BOARD_HEIGHT - 1 - row);
         player = (player == PLAYER1) ? PLAYER2 : PLAYER1;
+        empty--;
+    }
+}
+
+// Playout on the bitboard that takes an immediate win, blocks the
+// opponent's, and otherwise keeps out of the cells directly below an
+// opponent threat while it has other moves. Each step costs a few mask
+// operations on top of a random move; the result is in rollout's terms.
+double Node::heavyRollout(PlayedStones* played) {
+    if (checkWin(board, PLAYER1)) return 1.0;
+    if (checkWin(board, PLAYER2)) return -1.0;
+    BitBoard b = bitBoardFromCells(board, player);
+    int to_move = player;
+    double mover_wins = (to_move == PLAYER1) ? 1.0 : -1.0;  // result when the side to move wins
+
+    while (!b.full()) {
+        EndgameEntry entry;
+        if (endgameDB.loaded() && BitBoard::WIDTH * BitBoard::HEIGHT - b.moves <= endgameDB.maxEmpty() &&
+            endgameDB.probe(b, entry)) {
+            return entry.result * mover_wins;
+        }
+        BitBoard::Bits possible = b.possible();
+        if (BitBoard::winningCells(b.current, b.mask) & possible) {
+            return mover_wins;
+        }
+        BitBoard::Bits threats = BitBoard::winningCells(b.current ^ b.mask, b.mask);
+        BitBoard::Bits candidates = possible & threats;
+        if (candidates & (candidates - 1)) {
+            return -mover_wins;  // two wins to block, the opponent takes the other
+        }
+        if (candidates == 0) {
+            candidates = possible & ~(threats >> 1);
+            if (candidates == 0) candidates = possible;
+        }
+        for (int skip = mcts_rng() % popcount(candidates); skip > 0; skip--) {
+            candidates &= candidates - 1;
+        }
+        BitBoard::Bits move = candidates & (~candidates + 1);
+        if (played) played->by[to_move] |= move;
+        b.play(__builtin_ctzll(move) / (BitBoard::HEIGHT + 1));
+        to_move = (to_move == PLAYER1) ? PLAYER2 : PLAYER1;
+        mover_wins = -mover_wins;
     }
+    return 0.0;
+}
+
+// Value of a decided position or a solved endgame, in the same terms as
+// rollout (+1 when PLAYER1 wins). False when the position needs estimating.
+bool Node::exactValue(double& value) {
+    if (checkWin(board, PLAYER1)) { value = 1.0; return true; }
+    if (checkWin(board, PLAYER2)) { value = -1.0; return true; }
+    if (checkDraw(board)) { value = 0.0; return true; }
+    BitBoard b = bitBoardFromCells(board, player);
+    EndgameEntry entry;
+    if (endgameDB.loaded() && BitBoard::WIDTH * BitBoard::HEIGHT - b.moves <= endgameDB.maxEmpty() &&
+        endgameDB.probe(b, entry)) {
+        value = (player == PLAYER1) ? entry.result : -entry.result;
+        return true;
+    }
+    return false;
+}
+
+// Hybrid mode: the node's value in total_reward's terms when it has at most
+// mcts_settings.solve_empty empty cells, solved exactly the first time and
+// kept in proven after that. False above the threshold.
+bool Node::provenValue(double& reward) {
+    int8_t value = proven.load(std::memory_order_relaxed);
+    if (value == UNPROVEN) {
+        BitBoard b = bitBoardFromCells(board, player);
+        if (BitBoard::WIDTH * BitBoard::HEIGHT - b.moves > mcts_settings.solve_empty) {
+            return false;
+        }
+        // A game already won, by the mover or (below a won position the tree
+        // grew through) by the side to move, is scored as it stands
+        if (BitBoard::alignment(b.current ^ b.mask)) value = 1;
+        else if (BitBoard::alignment(b.current)) value = -1;
+        else value = -endgame_solver.solve(b);
+        proven.store(value, std::memory_order_relaxed);
+    }
+    reward = value;
+    return true;
+}
+
+// valueNet's estimate of this node, in the same terms as rollout, with
+// decided positions and solved endgames scored exactly
+double Node::evaluate() {
+    double value;
+    if (exactValue(value)) {
+        return value;
+    }
+    value = valueNet.evaluate(bitBoardFromCells(board, player));
+    return (player == PLAYER1) ? value : -value;
 }
 
 void Node::backpropagate(double reward) {
@@ -215,6 +379,26 @@ void Node::backpropagate(double reward) {
     if (parent) parent->backpropagate(-reward);
 }
 
+// Credits reward, as backpropagate passes it up from this node, to every
+// child along the path whose move its side made later in the simulation,
+// on the path or in the playout. Stops below top when given.
+void Node::updateRave(double reward, PlayedStones played, const Node* top) {
+    BitBoard leaf = bitBoardFromCells(board, PLAYER1);
+    played.by[PLAYER1] |= leaf.current;
+    played.by[PLAYER2] |= leaf.current ^ leaf.mask;
+    for (Node* node = this; node->parent != nullptr && node != top; node = node->parent, reward = -reward) {
+        Node* parent = node->parent;
+        BitBoard::Bits later = played.by[parent->player] & bitBoardFromCells(parent->board, parent->player).possible();
+        for (int col = 0; col < BOARD_WIDTH; col++) {
+            Node* child = parent->children[col];
+            if (child != nullptr && (later & BitBoard::column(col))) {
+                child->amaf_visits++;
+                child->amaf_reward += reward;
+            }
+        }
+    }
+}
+
 void Node::backpropagateParallel(double reward) {
     visit_count++;
     total_reward += reward;
@@ -223,15 +407,131 @@ void Node::backpropagateParallel(double reward) {
         if (parent->parent != nullptr) { // Not the root node
             parent->backpropagateParallel(-reward); 
         } else { // Parent is the root node
-            #pragma omp critical
-            {
-                parent->visit_count++;
-                parent->total_reward += -reward;
-            }
+            static std::mutex rootLock;
+            std::lock_guard<std::mutex> guard(rootLock);
+            parent->visit_count++;
+            parent->total_reward += -reward;
         }
     }
 }
 
+// Heap bytes of one node: the object, its board and its child array
+const size_t NODE_BYTES = sizeof(Node) + BOARD_WIDTH * BOARD_HEIGHT * sizeof(int) + BOARD_WIDTH * sizeof(Node*);
+
+// Tree size over the last search on this thread
+struct MctsMemory {
+    size_t nodes = 0;       // nodes in the tree when the search ended
+    size_t peak_nodes = 0;  // most nodes the tree held during the search
+    size_t recycled = 0;    // nodes freed to stay within the budget
+    size_t bytes() const { return peak_nodes * NODE_BYTES; }
+};
+thread_local MctsMemory mcts_memory;
+// Simulations the last search on this thread ran, for callers that search in slices
+thread_local int mcts_simulations = 0;
+
+// Node count of the tree under search against mcts_settings.max_nodes.
+// Expansions reserve their nodes first; a search that cannot reserve
+// evaluates the leaf itself instead of growing the tree.
+class TreeBudget {
+public:
+    explicit TreeBudget(Node* root)
+        : limit(mcts_settings.max_nodes == 0 ? 0 : std::max<size_t>(mcts_settings.max_nodes, 4 * BOARD_WIDTH)),
+          nodes(countNodes(root)), peak(nodes.load()) {}
+
+    bool reserve(size_t count) {
+        size_t total = nodes.fetch_add(count) + count;
+        if (limit > 0 && total > limit) {
+            nodes.fetch_sub(count);
+            return false;
+        }
+        size_t seen = peak.load();
+        while (total > seen && !peak.compare_exchange_weak(seen, total)) {}
+        return true;
+    }
+
+    // Nodes to free so that a full tree drops to three quarters of the
+    // budget, or 0 while the next expansion still fits
+    size_t excess() const {
+        size_t n = nodes.load();
+        return (limit > 0 && n + BOARD_WIDTH > limit && n > limit * 3 / 4) ? n - limit * 3 / 4 : 0;
+    }
+
+    // Nodes that can still be reserved
+    size_t room() const {
+        size_t n = nodes.load();
+        return limit == 0 ? SIZE_MAX : (n < limit ? limit - n : 0);
+    }
+
+    void release(size_t count) {
+        nodes -= count;
+        recycled += count;
+    }
+
+    void report() const {
+        mcts_memory.nodes = nodes.load();
+        mcts_memory.peak_nodes = peak.load();
+        mcts_memory.recycled = recycled.load();
+    }
+
+private:
+    size_t limit;
+    std::atomic<size_t> nodes;
+    std::atomic<size_t> peak;
+    std::atomic<size_t> recycled{0};
+};
+
+size_t countNodes(const Node* node) {
+    size_t count = 1;
+    for (const Node* child : node->children) {
+        if (child != nullptr) count += countNodes(child);
+    }
+    return count;
+}
+
+// Frees the subtrees below the least visited nodes until at least count
+// nodes are gone. A collapsed node stays in the tree as a leaf with its
+// statistics and is expanded again if selection returns to it. Returns the
+// number of nodes freed. Nothing may hold a pointer into the tree below the
+// root's children.
+size_t recycleTree(Node* root, size_t count) {
+    struct Candidate {
+        int visits;
+        int depth;
+        Node* node;
+    };
+    std::vector<Candidate> candidates;
+    std::vector<std::pair<Node*, int>> stack = {{root, 0}};
+    while (!stack.empty()) {
+        std::pair<Node*, int> top = stack.back();
+        stack.pop_back();
+        bool internal = false;
+        for (Node* child : top.first->children) {
+            if (child == nullptr) continue;
+            internal = true;
+            stack.push_back({child, top.second + 1});
+        }
+        if (internal && top.first != root) {
+            candidates.push_back({top.first->visit_count, top.second, top.first});
+        }
+    }
+    // A node never has more visits than its parent, so fewest visits and
+    // then deepest first collapses every subtree before anything above it
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.visits != b.visits ? a.visits < b.visits : a.depth > b.depth;
+    });
+    size_t freed = 0;
+    for (const Candidate& candidate : candidates) {
+        if (freed >= count) break;
+        for (Node*& child : candidate.node->children) {
+            if (child == nullptr) continue;
+            freed += countNodes(child);
+            delete child;
+            child = nullptr;
+        }
+    }
+    return freed;
+}
+
 int findFirstEmptyRow(const std::vector<int>& board, int column) {
     for (int row = BOARD_HEIGHT - 1; row >= 0; row--) {
         if (board[row * BOARD_WIDTH + column] == EMPTY) return row;
@@ -239,7 +539,43 @@ int findFirstEmptyRow(const std::vector<int>& board, int column) {
     return -1;
 }
 
+typedef BasicBitBoard<BOARD_WIDTH, BOARD_HEIGHT> Geometry;
+
 bool checkWin(const std::vector<int>& board, int player) {
+    Geometry::Bits own, occupied;
+    Geometry::fromCells(board, player, own, occupied);
+    return Geometry::alignment(own);
+}
+
+// Last column worth expanding: in a left-right symmetric position the right
+// half mirrors the left, so only columns up to the centre are distinct moves
+int lastDistinctColumn(const std::vector<int>& board) {
+    Geometry::Bits own, occupied;
+    Geometry::fromCells(board, PLAYER1, own, occupied);
+    return Geometry::make(own, occupied).symmetric() ? (BOARD_WIDTH - 1) / 2 : BOARD_WIDTH - 1;
+}
+
+// Static prior for player dropping a stone in column action of board:
+// immediate wins, then blocks of the opponent's win, then moves that open
+// new threes, and among the rest the central columns
+double movePrior(const std::vector<int>& board, int action, int player) {
+    Geometry::Bits own, occupied;
+    Geometry::fromCells(board, player, own, occupied);
+    if (Geometry::make(own, occupied).isWinningMove(action)) {
+        return 100.0;
+    }
+    Geometry::Bits opp = occupied ^ own;
+    Geometry::Bits stone = (occupied + Geometry::bottom(action)) & Geometry::column(action);
+    if (Geometry::alignment(opp | stone)) {
+        return 30.0;
+    }
+    int threats = Geometry::countOpenThrees(own | stone, opp) - Geometry::countOpenThrees(own, opp);
+    int centrality = BOARD_WIDTH / 2 - std::abs(action - BOARD_WIDTH / 2);
+    return 1.0 + 0.5 * centrality + 2.0 * std::max(0, threats);
+}
+
+// Cell-by-cell version of checkWin, kept as the reference for the kernel
+bool checkWinScan(const std::vector<int>& board, int player) {
     // Check rows
     for (int row = 0; row < BOARD_HEIGHT; row++) {
         for (int col = 0; col <= BOARD_WIDTH - 4; col++) {
@@ -278,62 +614,6 @@ bool checkWin(const std::vector<int>& board, int player) {
     return false;
 }
 
-bool checkWinParallel(const std::vector<int>& board, int player) {
-    bool winFound = false;
-    #pragma omp parallel for
-    for (int row = 0; row < BOARD_HEIGHT; row++) {
-        if (winFound) continue; // If a win is already found, other threads can stop
-        for (int col = 0; col <= BOARD_WIDTH - 4; col++) {
-            if (board[row * BOARD_WIDTH + col] == player &&
-                board[row * BOARD_WIDTH + col + 1] == player &&
-                board[row * BOARD_WIDTH + col + 2] == player &&
-                board[row * BOARD_WIDTH + col + 3] == player) {
-                #pragma omp critical
-                {
-                    winFound = true; 
-                }
-            }
-        }
-    }
-
-    #pragma omp parallel for 
-    for (int col = 0; col < BOARD_WIDTH; col++) {
-        if (winFound) continue; 
-        for (int row = 0; row <= BOARD_HEIGHT - 4; row++) {
-            if (board[row * BOARD_WIDTH + col] == player &&
-                board[(row + 1) * BOARD_WIDTH + col] == player &&
-                board[(row + 2) * BOARD_WIDTH + col] == player &&
-                board[(row + 3) * BOARD_WIDTH + col] == player) {
-                #pragma omp critical
-                {
-                    winFound = true; 
-                }
-            }
-        }
-    }
-
-    #pragma omp parallel for 
-    for (int row = 0; row <= BOARD_HEIGHT - 4; row++) {
-        if (winFound) continue; 
-        for (int col = 0; col <= BOARD_WIDTH - 4; col++) {
-            if ((board[row * BOARD_WIDTH + col] == player &&
-                 board[(row + 1) * BOARD_WIDTH + col + 1] == player &&
-                 board[(row + 2) * BOARD_WIDTH + col + 2] == player &&
-                 board[(row + 3) * BOARD_WIDTH + col + 3] == player) || 
-                (board[row * BOARD_WIDTH + col + 3] == player &&
-                 board[(row + 1) * BOARD_WIDTH + col + 2] == player &&
-                 board[(row + 2) * BOARD_WIDTH + col + 1] == player &&
-                 board[(row + 3) * BOARD_WIDTH + col] == player)) {
-                #pragma omp critical
-                {
-                    winFound = true; 
-                }
-            }
-        }
-    }
-    return winFound;
-}
-
 bool checkDraw(const std::vector<int>& board) {
     for (int col = 0; col < BOARD_WIDTH; col++) {
         if (findFirstEmptyRow(board, col) != -1) return false;
@@ -341,21 +621,14 @@ bool checkDraw(const std::vector<int>& board) {
     return true;
 }
 
-bool checkDrawParallel(const std::vector<int>& board) {
-    bool isDraw = true; // Shared variable
-    #pragma omp parallel for 
-    for (int col = 0; col < BOARD_WIDTH; col++) {
-        if (findFirstEmptyRow(board, col) != -1) {
-            #pragma omp critical
-            {
-                isDraw = false; 
-            }
-        }
-    }
-    return isDraw;
+int countWinningLines(const std::vector<int>& board, int player) {
+    Geometry::Bits own, occupied;
+    Geometry::fromCells(board, player, own, occupied);
+    return Geometry::countOpenThrees(own, occupied ^ own);
 }
 
-int countWinningLines(const std::vector<int>& board, int player) {
+// Cell-by-cell version of countWinningLines, kept as the reference for the kernel
+int countWinningLinesScan(const std::vector<int>& board, int player) {
     int count = 0;
 
     // Check rows
@@ -452,12 +725,133 @@ int evaluateHeuristic(Node* node) {
 }
 
 
-std::vector<int> mcts(Node* root) {
+// Playout stream of simulation number index in a search seeded with seed
+// (splitmix64). In the reproducible mode the searches select leaves in a
+// fixed order and fix the work of every task, so with the same seed and
+// thread count they end with the same visit counts. That mode ignores the
+// deadline and does not seed the root from the analysis cache.
+uint32_t simulationSeed(uint64_t seed, uint64_t index) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL * (index + 1);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return (uint32_t)(z ^ (z >> 31));
+}
+
+// A leaf chosen by mcts_batched, waiting in a batch for its evaluation
+struct PendingLeaf {
+    Node* node;
+    double reward;
+    bool evaluated;  // reward already known, the leaf is terminal
+    int simulation;  // index in the search, seeds the playout of a seeded search
+    PlayedStones played;
+};
+
+// Selects and expands a leaf like mcts does, then charges every node on its
+// path a visit and a virtual loss so the next selections spread to other
+// leaves until this one's result is in. The caller holds the tree lock.
+PendingLeaf selectPendingLeaf(Node* root, TreeBudget& budget, int simulation) {
+    Node* node = root;
+    while (node->selectChild() != nullptr) {
+        node = node->selectChild();
+    }
+    std::vector<int> available_moves;
+    for (int col = 0, last = lastDistinctColumn(node->board); col <= last; col++) {
+        if (findFirstEmptyRow(node->board, col) != -1 && node->children[col] == nullptr) {
+            available_moves.push_back(col);
+        }
+    }
+    bool expanded = (node == root || !node->isProven()) && budget.reserve(available_moves.size());
+    if (expanded) {
+        for (int move : available_moves) {
+            node->expand(move);
+        }
+    }
+    PendingLeaf leaf = {node, 0.0, false, simulation, PlayedStones()};
+    if (node->selectChild() != nullptr) {
+        leaf.node = node->selectChild();
+    } else if (expanded) {
+        leaf.reward = -evaluateHeuristic(node);
+        leaf.evaluated = true;
+    }
+    for (Node* n = leaf.node; n != nullptr; n = n->parent) {
+        n->visit_count++;
+        n->total_reward -= VIRTUAL_LOSS;
+    }
+    return leaf;
+}
+
+void evaluateLeaf(PendingLeaf& leaf) {
+    if (leaf.evaluated) return;
+    if (mcts_settings.seed != 0) {
+        mcts_rng.seed(simulationSeed(mcts_settings.seed, leaf.simulation));
+    }
+    leaf.reward = leaf.node->leafValue(&leaf.played);
+}
+
+// Rewards for a batch of leaves: a rollout each, or one valueNet call over
+// every leaf that is not decided or solved
+void evaluateLeaves(std::vector<PendingLeaf>& batch) {
+    if (!mcts_settings.value_net) {
+        for (PendingLeaf& leaf : batch) {
+            evaluateLeaf(leaf);
+        }
+        return;
+    }
+    std::vector<BitBoard> boards;
+    std::vector<PendingLeaf*> estimated;
+    for (PendingLeaf& leaf : batch) {
+        if (leaf.evaluated || leaf.node->provenValue(leaf.reward)) continue;
+        if (leaf.node->exactValue(leaf.reward)) {
+            leaf.reward = leaf.node->forMover(leaf.reward);
+            continue;
+        }
+        boards.push_back(bitBoardFromCells(leaf.node->board, leaf.node->player));
+        estimated.push_back(&leaf);
+    }
+    std::vector<float> values(boards.size());
+    valueNet.evaluate(boards.data(), boards.size(), values.data());
+    for (size_t i = 0; i < estimated.size(); i++) {
+        estimated[i]->reward = -values[i];  // the net scores for the side to move
+    }
+}
+
+// Backpropagates an evaluated leaf, returning the virtual loss. The visits
+// were counted at selection. The caller holds the tree lock.
+void completeLeaf(const PendingLeaf& leaf) {
+    double reward = leaf.reward;
+    for (Node* n = leaf.node; n != nullptr; n = n->parent) {
+        n->total_reward += VIRTUAL_LOSS + reward;
+        reward = -reward;
+    }
+    if (mcts_settings.rave_equivalence > 0) {
+        leaf.node->updateRave(leaf.reward, leaf.played);
+    }
+}
+
+std::vector<int> mcts(Node* root, int num_simulations, std::chrono::steady_clock::time_point deadline,
+                      const std::atomic<bool>* stop) {
     if (root == nullptr || root->board.empty()) {
         return std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
     }
+    seedRootFromCache(root);
+    TreeBudget budget(root);
+    if (mcts_settings.seed != 0) {
+        mcts_rng.seed(simulationSeed(mcts_settings.seed, 0));
+    }
 
-    for (int i = 0; i < NUM_SIMULATIONS; i++) {
+    int i = 0;
+    for (; i < num_simulations; i++) {
+        // Polling the clock every simulation is wasteful, 64 playouts are well under a millisecond
+        if (mcts_settings.seed == 0 && (i & 63) == 63 && std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+            break;
+        }
+        // A full tree gives up its least visited subtrees before selection starts
+        if (budget.excess() > 0) {
+            budget.release(recycleTree(root, budget.excess()));
+        }
         Node* node = root;
         
         // Selection
@@ -467,28 +861,41 @@ std::vector<int> mcts(Node* root) {
 
         // Expansion - Expand on all valid children 
         std::vector<int> available_moves;
-        for (int col = 0; col < BOARD_WIDTH; col++) {
+        for (int col = 0, last = lastDistinctColumn(node->board); col <= last; col++) {
             if (findFirstEmptyRow(node->board, col) != -1) {
                 available_moves.push_back(col);
             }
         }
-        for (int move : available_moves) {
-            node->expand(move); // Expand on all valid moves
+        bool expanded = (node == root || !node->isProven()) && budget.reserve(available_moves.size());
+        if (expanded) {
+            for (int move : available_moves) {
+                node->expand(move); // Expand on all valid moves
+            }
         }
 
         // Simulation
         double reward = 0.0;
+        PlayedStones played;
         if (node->selectChild() != nullptr) { // If we expanded, choose a child to simulate from
             node = node->selectChild();
-            reward = node->rollout(); 
+            reward = node->leafValue(&played);
+        } else if (!expanded) { // Out of nodes, the leaf is simulated itself
+            reward = node->leafValue(&played);
         } else { // If no expansion was possible (terminal node), evaluate it
-            reward = evaluateHeuristic(node);
+            reward = -evaluateHeuristic(node);
         }
 
         // Backpropagation
         node->backpropagate(reward); 
+        if (mcts_settings.rave_equivalence > 0) {
+            node->updateRave(reward, played);
+        }
     }
 
+    budget.report();
+    mcts_simulations = i;
+    storeRootInCache(root);
+
     // Select the best move based on visit count
     Node* best_child = nullptr;
     int best_visit_count = 0;
@@ -501,50 +908,79 @@ std::vector<int> mcts(Node* root) {
     return best_child ? best_child->board : std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
 }
 
-std::vector<int> mcts_parallel_1(Node* root) {
+std::vector<int> mcts_parallel_1(Node* root, int num_simulations, std::chrono::steady_clock::time_point deadline,
+                                 const std::atomic<bool>* stop) {
     if (root == nullptr || root->board.empty()) {
         return std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
     }
-
-    #pragma omp parallel for
-    for (int i = 0; i < NUM_SIMULATIONS; i++) {
-        Node* node = root;
-
-        // Selection
-        while (node->selectChild() != nullptr) { 
-            node = node->selectChild();
+    seedRootFromCache(root);
+
+    // One task per search thread, all sharing the tree. Tasks may run on
+    // scheduler workers, so each takes the caller's settings along.
+    std::mutex treeLock;
+    MctsSettings settings = mcts_settings;
+    TreeBudget budget(root);
+    int tasks = std::max(1u, SEARCH_THREADS);
+    std::atomic<int> simulated(0);
+    TaskGroup group;
+    // Seeded: rounds of one leaf per task, selected in order under virtual
+    // loss, evaluated in parallel and backpropagated in order
+    for (int i = 0; settings.seed != 0 && i < num_simulations; i += tasks) {
+        if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+            break;
         }
-
-        // Expansion
-        std::vector<int> available_moves;
-        for (int col = 0; col < BOARD_WIDTH; col++) {
-            if (findFirstEmptyRow(node->board, col) != -1) {
-                available_moves.push_back(col);
-            }
+        std::vector<PendingLeaf> round;
+        for (int t = 0; t < tasks && i + t < num_simulations; t++) {
+            round.push_back(selectPendingLeaf(root, budget, i + t));
         }
-
-        #pragma omp critical
-        {
-            for (int move : available_moves) {
-                node->expand(move); 
-            }
+        for (PendingLeaf& leaf : round) {
+            searchScheduler().spawn(group, [&leaf, settings]() {
+                mcts_settings = settings;
+                evaluateLeaf(leaf);
+            });
         }
-
-        // Simulation
-        double reward = 0.0;
-        if (node->selectChild() != nullptr) { 
-            node = node->selectChild();
-            reward = node->rollout(); 
-        } else { 
-            reward = evaluateHeuristic(node);
+        searchScheduler().wait(group);
+        for (const PendingLeaf& leaf : round) {
+            completeLeaf(leaf);
         }
+        simulated += round.size();
+    }
+    for (int t = 0; settings.seed == 0 && t < tasks; t++) {
+        int share = num_simulations / tasks + (t < num_simulations % tasks ? 1 : 0);
+        searchScheduler().spawn(group, [root, share, deadline, stop, settings, &treeLock, &budget, &simulated]() {
+            mcts_settings = settings;
+            int i = 0;
+            for (; i < share; i++) {
+                if ((i & 63) == 63 && std::chrono::steady_clock::now() >= deadline) {
+                    break;
+                }
+                if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+                    break;
+                }
+                // Selection and expansion read and grow the shared tree,
+                // so they happen under the lock; the virtual loss on the
+                // path steers the other tasks to other leaves meanwhile
+                PendingLeaf leaf;
+                {
+                    std::lock_guard<std::mutex> guard(treeLock);
+                    leaf = selectPendingLeaf(root, budget, i);
+                }
 
-        // Backpropagation
-        #pragma omp critical 
-        {
-            node->backpropagate(reward); 
-        }
+                // Simulation
+                evaluateLeaf(leaf);
+
+                // Backpropagation
+                std::lock_guard<std::mutex> guard(treeLock);
+                completeLeaf(leaf);
+            }
+            simulated += i;
+        });
     }
+    searchScheduler().wait(group);
+
+    budget.report();
+    mcts_simulations = simulated;
+    storeRootInCache(root);
 
     // Select the best move based on visit count
     Node* best_child = nullptr;
@@ -558,26 +994,54 @@ std::vector<int> mcts_parallel_1(Node* root) {
     return best_child ? best_child->board : std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
 }
 
-std::vector<int> mcts_parallel_2(Node* root) {
+std::vector<int> mcts_parallel_2(Node* root, int num_simulations, std::chrono::steady_clock::time_point deadline,
+                                 const std::atomic<bool>* stop) {
     if (root == nullptr || root->board.empty()) {
         return std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
     }
+    seedRootFromCache(root);
 
     // Initialize root's children based on available moves
     std::vector<int> available_moves;
-    for (int col = 0; col < BOARD_WIDTH; col++) {
+    for (int col = 0, last = lastDistinctColumn(root->board); col <= last; col++) {
         if (findFirstEmptyRow(root->board, col) != -1) {
             available_moves.push_back(col);
-            root->expand(col); // Expand on all valid moves
+            if (root->children[col] == nullptr) {
+                root->expand(col); // Expand on all valid moves, keeping subtrees from earlier searches
+            }
         }
     }
 
-    // Parallel MCTS for each child of the root
-    #pragma omp parallel for
-    for (int i = 0; i < root->children.size(); ++i) {
-        if (root->children[i] != nullptr) {
-            for (int j = 0; j < NUM_SIMULATIONS / root->children.size(); ++j) { // Distribute simulations evenly
-                Node* node = root->children[i];
+    // One scheduler task per child of the root, each searching its own subtree
+    MctsSettings settings = mcts_settings;
+    TreeBudget budget(root);
+    // Distribute simulations evenly over the children the root has: a
+    // symmetric root leaves its mirrored columns empty
+    int searched = std::count_if(root->children.begin(), root->children.end(), [](Node* c) { return c != nullptr; });
+    int simulations = num_simulations / std::max(1, searched);
+    // Seeded, every subtree gets an equal share of the free budget so its
+    // expansions do not depend on how far the others have got
+    size_t quota = (settings.seed != 0) ? budget.room() / std::max<size_t>(1, available_moves.size()) : SIZE_MAX;
+    std::atomic<int> simulated(0);
+    TaskGroup group;
+    for (int col = 0; col < BOARD_WIDTH; col++) {
+        Node* child = root->children[col];
+        if (child == nullptr) continue;
+        searchScheduler().spawn(group, [child, col, simulations, deadline, stop, settings, quota, &budget, &simulated]() {
+            mcts_settings = settings;
+            if (settings.seed != 0) {
+                mcts_rng.seed(simulationSeed(settings.seed, col));
+            }
+            size_t room = quota;
+            int j = 0;
+            for (; j < simulations; ++j) {
+                if (settings.seed == 0 && (j & 63) == 63 && std::chrono::steady_clock::now() >= deadline) {
+                    break;
+                }
+                if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+                    break;
+                }
+                Node* node = child;
 
                 // Selection
                 while (node->selectChild() != nullptr) {
@@ -586,27 +1050,120 @@ std::vector<int> mcts_parallel_2(Node* root) {
 
                 // Expansion (if not a terminal node)
                 std::vector<int> child_moves;
-                for (int col = 0; col < BOARD_WIDTH; col++) {
+                for (int col = 0, last = lastDistinctColumn(node->board); col <= last; col++) {
                     if (findFirstEmptyRow(node->board, col) != -1) {
                         child_moves.push_back(col);
-                        node->expand(col); // Expand on all valid moves
+                    }
+                }
+                bool expanded = !node->isProven() && child_moves.size() <= room && budget.reserve(child_moves.size());
+                if (expanded) {
+                    room -= child_moves.size();
+                    for (int move : child_moves) {
+                        node->expand(move); // Expand on all valid moves
                     }
                 }
 
                 // Simulation
                 double reward = 0.0;
+                PlayedStones played;
                 if (node->selectChild() != nullptr) { 
                     node = node->selectChild();
-                    reward = node->rollout();
+                    reward = node->leafValue(&played);
+                } else if (!expanded) {
+                    reward = node->leafValue(&played);
                 } else { 
-                    reward = evaluateHeuristic(node);
+                    reward = -evaluateHeuristic(node);
                 }
 
                 // Backpropagation (modified for parallel subtrees)
                 node->backpropagateParallel(reward);
+                // The root's children belong to the other tasks, so RAVE stays inside this subtree
+                if (settings.rave_equivalence > 0) {
+                    node->updateRave(reward, played, child);
+                }
             }
+            simulated += j;
+        });
+    }
+    searchScheduler().wait(group);
+
+    budget.report();
+    mcts_simulations = simulated;
+    storeRootInCache(root);
+
+    // Select the best move based on visit count
+    Node* best_child = nullptr;
+    int best_visit_count = 0;
+    for (Node* child : root->children) {
+        if (child != nullptr && child->visit_count > best_visit_count) {
+            best_child = child;
+            best_visit_count = child->visit_count;
         }
     }
+    return best_child ? best_child->board : std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
+}
+
+// Selection and evaluation as a pipeline: the calling thread keeps
+// selecting leaves under virtual loss and hands every batch_size of them to
+// a scheduler task, which evaluates the batch and backpropagates it. At most
+// one batch per scheduler thread is in flight; when the oldest has not come
+// back the caller helps evaluate instead of selecting further.
+std::vector<int> mcts_batched(Node* root, int num_simulations, std::chrono::steady_clock::time_point deadline,
+                              int batch_size, const std::atomic<bool>* stop) {
+    if (root == nullptr || root->board.empty()) {
+        return std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
+    }
+    seedRootFromCache(root);
+
+    std::mutex treeLock;
+    MctsSettings settings = mcts_settings;
+    TreeBudget budget(root);
+    std::vector<TaskGroup> in_flight(searchScheduler().workers() + 1);
+    size_t slot = 0;
+    std::vector<PendingLeaf> batch;
+    auto dispatch = [&]() {
+        searchScheduler().wait(in_flight[slot]);
+        searchScheduler().spawn(in_flight[slot], [batch, settings, &treeLock]() mutable {
+            mcts_settings = settings;
+            evaluateLeaves(batch);
+            std::lock_guard<std::mutex> guard(treeLock);
+            for (const PendingLeaf& leaf : batch) {
+                completeLeaf(leaf);
+            }
+        });
+        // Seeded, the next selection must see this batch's results whatever the timing
+        if (settings.seed != 0) {
+            searchScheduler().wait(in_flight[slot]);
+        }
+        slot = (slot + 1) % in_flight.size();
+        batch.clear();
+    };
+    int i = 0;
+    for (; i < num_simulations; i++) {
+        if (settings.seed == 0 && (i & 63) == 63 && std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        if (stop != nullptr && stop->load(std::memory_order_relaxed)) {
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> guard(treeLock);
+            batch.push_back(selectPendingLeaf(root, budget, i));
+        }
+        if ((int)batch.size() >= batch_size) {
+            dispatch();
+        }
+    }
+    if (!batch.empty()) {
+        dispatch();
+    }
+    for (TaskGroup& group : in_flight) {
+        searchScheduler().wait(group);
+    }
+
+    budget.report();
+    mcts_simulations = i;
+    storeRootInCache(root);
 
     // Select the best move based on visit count
     Node* best_child = nullptr;
@@ -620,6 +1177,65 @@ std::vector<int> mcts_parallel_2(Node* root) {
     return best_child ? best_child->board : std::vector<int>(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
 }
 
+// Gives a fresh root the child statistics of an earlier search from the
+// analysis cache, so the search continues where that one stopped.
+void seedRootFromCache(Node* root) {
+    CacheRecord record;
+    if (mcts_settings.seed != 0) return;  // earlier runs must not change a reproducible search
+    for (Node* child : root->children) {
+        if (child != nullptr) return;
+    }
+    if (!analysisCache.loaded() || !analysisCache.probe(bitBoardFromCells(root->board, root->player), record)) {
+        return;
+    }
+    int total = 0;
+    for (int col = 0; col < BOARD_WIDTH; col++) {
+        if (record.visits[col] == 0 || findFirstEmptyRow(root->board, col) == -1) continue;
+        Node* child = root->expand(col);
+        child->visit_count = record.visits[col];
+        child->total_reward = record.rewards[col];
+        total += record.visits[col];
+    }
+    root->visit_count = total;
+    root->total_reward = 0;
+}
+
+void storeRootInCache(Node* root) {
+    if (!analysisCache.loaded()) return;
+    uint32_t visits[BOARD_WIDTH] = {};
+    float rewards[BOARD_WIDTH] = {};
+    for (int col = 0; col < BOARD_WIDTH; col++) {
+        if (root->children[col] != nullptr) {
+            visits[col] = root->children[col]->visit_count;
+            rewards[col] = (float)root->children[col]->total_reward;
+        }
+    }
+    analysisCache.storeVisits(bitBoardFromCells(root->board, root->player), visits, rewards);
+}
+
+// Returns the column that differs between two consecutive boards, or -1
+int moveColumn(const std::vector<int>& before, const std::vector<int>& after) {
+    for (int i = 0; i < BOARD_WIDTH * BOARD_HEIGHT; i++) {
+        if (before[i] != after[i]) return i % BOARD_WIDTH;
+    }
+    return -1;
+}
+
+// Re-roots the tree at the child reached by playing column, keeping that
+// subtree and freeing the rest. The old root must not be used afterwards.
+Node* advanceRoot(Node* root, int column) {
+    Node* child = root->children[column];
+    if (child == nullptr) {
+        std::vector<int> new_board(root->board);
+        new_board[findFirstEmptyRow(new_board, column) * BOARD_WIDTH + column] = root->player;
+        child = new Node(new_board, (root->player == PLAYER1) ? PLAYER2 : PLAYER1);
+    }
+    root->children[column] = nullptr;
+    child->parent = nullptr;
+    delete root;
+    return child;
+}
+
 void printBoard(const std::vector<int>& board) {
     std::cout << "-------------" << std::endl;
     for (int row = 0; row < BOARD_HEIGHT; row++) {
@@ -639,7 +1255,43 @@ void printBoard(const std::vector<int>& board) {
     std::cout << "-------------" << std::endl;
 }
 
-int main() {
+#ifndef CONNECT4_NO_MAIN
+// Simulation cap for one pondering session, so a long think by the user
+// cannot grow the tree without bound
+const int PONDER_SIMULATIONS = 10 * NUM_SIMULATIONS;
+
+int main(int argc, char** argv) {
+    // Usage: mcts_connect4 [--ponder] [--threads N] [--pin] [--value-net FILE|default] [--heavy] [--rave K]
+    //                      [--solve EMPTY] [--max-nodes N] [--seed S] [endgame-db|-] [analysis-cache]
+    // CONNECT4_THREADS and CONNECT4_PIN set the defaults of --threads and --pin.
+    bool ponder = false;
+    std::vector<char*> args = {argv[0]};
+    for (int a = 1; a < argc; a++) {
+        if (std::string(argv[a]) == "--ponder") ponder = true;
+        else if (std::string(argv[a]) == "--value-net" && a + 1 < argc) {
+            mcts_settings.value_net = true;
+            if (std::string(argv[++a]) != "default" && !valueNet.load(argv[a])) {
+                std::cout << "Could not load value net " << argv[a] << ", using the default weights." << std::endl;
+            }
+        }
+        else if (std::string(argv[a]) == "--pin") PIN_THREADS = true;
+        else if (std::string(argv[a]) == "--heavy") mcts_settings.heavy_playouts = true;
+        else if (std::string(argv[a]) == "--rave" && a + 1 < argc) mcts_settings.rave_equivalence = atof(argv[++a]);
+        else if (std::string(argv[a]) == "--solve" && a + 1 < argc) mcts_settings.solve_empty = atoi(argv[++a]);
+        else if (std::string(argv[a]) == "--max-nodes" && a + 1 < argc) mcts_settings.max_nodes = std::strtoull(argv[++a], nullptr, 10);
+        else if (std::string(argv[a]) == "--seed" && a + 1 < argc) mcts_settings.seed = std::strtoull(argv[++a], nullptr, 10);
+        else if (std::string(argv[a]) == "--threads" && a + 1 < argc) SEARCH_THREADS = std::max(1, atoi(argv[++a]));
+        else args.push_back(argv[a]);
+    }
+    argc = args.size();
+    argv = args.data();
+    if (argc >= 2 && std::string(argv[1]) != "-" && !endgameDB.open(argv[1])) {
+        std::cout << "Could not load endgame database " << argv[1] << ", playing without it." << std::endl;
+    }
+    if (argc >= 3 && !analysisCache.open(argv[2])) {
+        std::cout << "Could not open analysis cache " << argv[2] << ", playing without it." << std::endl;
+    }
+    std::cout << describeThreads() << std::endl;
     std::vector<int> initial_board(BOARD_WIDTH * BOARD_HEIGHT, EMPTY);
     Node* root = new Node(initial_board, PLAYER1);
 
@@ -653,12 +1305,30 @@ int main() {
         }
         int player1_move;
         std::cout << "Player 1, enter your move (0-6): ";
+        // Keep searching the current position while waiting; the subtree of
+        // the move actually played is kept below
+        std::atomic<bool> stop_pondering(false);
+        std::thread ponder_thread;
+        if (ponder) {
+            MctsSettings settings = mcts_settings;
+            ponder_thread = std::thread([root, settings, &stop_pondering]() {
+                mcts_settings = settings;
+                mcts(root, PONDER_SIMULATIONS, std::chrono::steady_clock::time_point::max(), &stop_pondering);
+            });
+        }
         std::cin >> player1_move;
+        if (ponder) {
+            stop_pondering = true;
+            ponder_thread.join();
+        }
+        if (!std::cin) {
+            break;
+        }
         if (std::find(available_moves.begin(), available_moves.end(), player1_move) == available_moves.end()) {
             std::cout << "Invalid move, try again." << std::endl;
             continue;
         }
-        root = root->expand(player1_move);
+        root = advanceRoot(root, player1_move);
 
         
 
@@ -693,58 +1363,43 @@ int main() {
         // elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
         // std::cout << "Time taken for checkDraw serial (" << NUM_ITERATIONS << " iterations): " << elapsed_ns.count() << " ns" << std::endl;
 
-        // result_start = std::chrono::high_resolution_clock::now();
-        // for (int i = 0; i < NUM_ITERATIONS; ++i) {
-        //     checkWinParallel(root->board, PLAYER1);
-        // }
-        // result_end = std::chrono::high_resolution_clock::now();
-        // elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
-        // std::cout << "Time taken for checkWin parallel (" << NUM_ITERATIONS << " iterations): " << elapsed_ns.count() << " ns" << std::endl;
 
-        // result_start = std::chrono::high_resolution_clock::now();
-        // for (int i = 0; i < NUM_ITERATIONS; ++i) {
-        //     checkDrawParallel(root->board);
-        // }
-        // result_end = std::chrono::high_resolution_clock::now();
-        // elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
-        // std::cout << "Time taken for checkDraw parallel (" << NUM_ITERATIONS << " iterations): " << elapsed_ns.count() << " ns" << std::endl;
-
-
-        // AI (Player 2) move
-
-        //benchmarking mcts serial, parallel approach 1 and parallel approach 2
-        auto result_start = std::chrono::high_resolution_clock::now();
-        mcts(root);
-        auto result_end = std::chrono::high_resolution_clock::now();
-        std::chrono::nanoseconds elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
-        std::cout << "Time taken for mcts serial: " << elapsed_ns.count() << " ns" << std::endl;
-
-        result_start = std::chrono::high_resolution_clock::now();
-        mcts_parallel_1(root);
-        result_end = std::chrono::high_resolution_clock::now();
-        elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
-        std::cout << "Time taken for mcts parallel approach 1: " << elapsed_ns.count() << " ns" << std::endl;
-
-        result_start = std::chrono::high_resolution_clock::now();
-        mcts_parallel_2(root);
-        result_end = std::chrono::high_resolution_clock::now();
-        elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
-        std::cout << "Time taken for mcts parallel approach 2: " << elapsed_ns.count() << " ns" << std::endl;
-
-
-        root->board = mcts_parallel_2(root);
-        if (!checkWin(root->board, PLAYER2) && !checkDraw(root->board)) {
-            root = root->selectChild();
-        }
-        // // AI (Player 2) move using BFS analysis for immediate moves
-        // int bestMove = bfsImmediateAnalysis(root, 4); // Checking up to 3 moves ahead
-        // if (bestMove != -1) {
-        //     root = root->expand(bestMove);
-        // } else {
-        //     // Fall back to MCTS if no immediate beneficial move is found
-        //     root->board = mcts(root);
-        //     root = root->selectChild();
-        // }
+        // AI (Player 2) move. A forced position is played straight from the
+        // threat search; otherwise benchmark mcts serial, parallel approach 1
+        // and parallel approach 2, then play the parallel approach 2 move
+        ForcedMove forced = forcedMove(bitBoardFromCells(root->board, root->player));
+        if (forced.move != -1) {
+            std::cout << "Forced move " << forced.move;
+            if (forced.result != 0) {
+                std::cout << " (" << (forced.result > 0 ? "win" : "loss") << " in " << forced.plies << " plies)";
+            }
+            std::cout << std::endl;
+            root = advanceRoot(root, forced.move);
+        } else {
+            auto result_start = std::chrono::high_resolution_clock::now();
+            mcts(root);
+            auto result_end = std::chrono::high_resolution_clock::now();
+            std::chrono::nanoseconds elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
+            std::cout << "Time taken for mcts serial: " << elapsed_ns.count() << " ns" << std::endl;
+
+            result_start = std::chrono::high_resolution_clock::now();
+            mcts_parallel_1(root);
+            result_end = std::chrono::high_resolution_clock::now();
+            elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
+            std::cout << "Time taken for mcts parallel approach 1: " << elapsed_ns.count() << " ns" << std::endl;
+
+            result_start = std::chrono::high_resolution_clock::now();
+            mcts_parallel_2(root);
+            result_end = std::chrono::high_resolution_clock::now();
+            elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(result_end - result_start);
+            std::cout << "Time taken for mcts parallel approach 2: " << elapsed_ns.count() << " ns" << std::endl;
+
+
+            std::vector<int> ai_board = mcts_parallel_2(root);
+            std::cout << "Search tree: " << mcts_memory.nodes << " nodes, peak " << mcts_memory.peak_nodes << " ("
+                      << mcts_memory.bytes() / 1024 << " KB), " << mcts_memory.recycled << " recycled" << std::endl;
+            root = advanceRoot(root, moveColumn(root->board, ai_board));
+        }
 
 
         // Check for win or draw
@@ -766,4 +1421,5 @@ int main() {
     delete root;
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
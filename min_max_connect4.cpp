@@ -4,14 +4,123 @@
 #include <limits.h>
 #include <array>
 #include <sstream>
-#include <omp.h> 
 #include <chrono>
-
-#define min(a,b) (((a) < (b)) ? (a) : (b))
-#define max(a,b) (((a) > (b)) ? (a) : (b))
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <memory>
+#include "endgame_db.h"
+#include "analysis_cache.h"
+#include "task_scheduler.h"
+#include "threat_search.h"
 
 using namespace std;
 
+// Transposition table shared by successive searches of the same game.
+// Entries are stored as (key ^ data, data) so that a torn write from a
+// concurrent thread fails the key check instead of returning garbage.
+// The entries are allocated as raw storage and constructed in shards by the
+// search workers, so each page is first touched by a worker and the table
+// spreads over their NUMA nodes.
+enum TTFlag { TT_EXACT = 0, TT_LOWER = 1, TT_UPPER = 2 };
+
+struct TTEntry {
+    atomic<uint64_t> check;
+    atomic<uint64_t> data;
+};
+
+class TranspositionTable {
+public:
+    explicit TranspositionTable(size_t numEntries = 1 << 20)
+        : entries(static_cast<TTEntry*>(::operator new(max<size_t>(1, numEntries) * sizeof(TTEntry)))),
+          size(max<size_t>(1, numEntries)) {
+        clear();
+    }
+
+    bool probe(uint64_t key, int& score, int& move, unsigned int& depth, int& flag) {
+        TTEntry& e = entries[slot(key)];
+        uint64_t data = e.data.load(memory_order_relaxed);
+        if ((e.check.load(memory_order_relaxed) ^ data) != key || data == 0) {
+            return false;
+        }
+        score = (int)(uint32_t)(data >> 32);
+        move = (int)((data >> 16) & 0xff) - 1;
+        depth = (data >> 2) & 0x3fff;
+        flag = data & 0x3;
+        return true;
+    }
+
+    void store(uint64_t key, int score, int move, unsigned int depth, int flag) {
+        uint64_t data = ((uint64_t)(uint32_t)score << 32) | ((uint64_t)((move + 1) & 0xff) << 16) |
+                        ((uint64_t)(depth & 0x3fff) << 2) | (uint64_t)flag;
+        TTEntry& e = entries[slot(key)];
+        e.check.store(key ^ data, memory_order_relaxed);
+        e.data.store(data, memory_order_relaxed);
+    }
+
+    void clear() {
+        clearShards(size, [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                TTEntry* e = new (&entries[i]) TTEntry;
+                e->check.store(0, memory_order_relaxed);
+                e->data.store(0, memory_order_relaxed);
+            }
+        });
+    }
+
+private:
+    // Position keys are column bit patterns, so the low bits alone would map
+    // positions differing only in the left columns to the same slot
+    size_t slot(uint64_t key) const {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key % size;
+    }
+
+    // TTEntry is trivially destructible, so freeing the storage is enough
+    struct FreeStorage {
+        void operator()(TTEntry* p) const { ::operator delete(p); }
+    };
+
+    unique_ptr<TTEntry[], FreeStorage> entries;
+    size_t size;
+};
+
+// Optional per-search state threaded through miniMax / miniMaxParallel.
+// tt may be null; deadline and stop let a caller bound the search in time,
+// and cancel lets another thread end it through a flag of its own.
+// A deterministic search ignores the deadline, and miniMaxParallel then
+// leaves the transposition table and analysis cache alone: what its
+// concurrent subtrees would find there depends on thread timing. Its move,
+// score and node count are then the same on every run.
+struct SearchState {
+    TranspositionTable* tt = nullptr;
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+    atomic<bool> stop{false};
+    atomic<uint64_t> nodes{0};
+    bool deterministic = false;
+    const atomic<bool>* cancel = nullptr;
+
+    bool stopped() {
+        if (cancel != nullptr && cancel->load(memory_order_relaxed)) {
+            stop.store(true, memory_order_relaxed);
+        }
+        if (stop.load(memory_order_relaxed) || deterministic) {
+            return stop.load(memory_order_relaxed);
+        }
+        // Checking the clock on every node is measurable, so only poll it every 1024 nodes
+        if ((nodes.load(memory_order_relaxed) & 1023) == 0 && chrono::steady_clock::now() >= deadline) {
+            stop.store(true, memory_order_relaxed);
+        }
+        return stop.load(memory_order_relaxed);
+    }
+};
+
+// Root search algorithms: plain alpha-beta (miniMax / miniMaxParallel),
+// principal variation search (miniMaxPVS) and MTD(f) on top of PVS (mtdf)
+enum SearchAlgorithm { SEARCH_ALPHABETA, SEARCH_PVS, SEARCH_MTDF };
+
 void printBoard(vector<vector<int>>&);
 int userMove();
 void makeMove(vector<vector<int>>&, int, unsigned int);
@@ -19,17 +128,30 @@ void errorMessage(int);
 int aiMove();
 vector<vector<int>> copyBoard(vector<vector<int>>);
 bool winningMove(vector<vector<int>>&, unsigned int);
+bool winningMoveScan(vector<vector<int>>&, unsigned int);
 int scoreSet(vector<unsigned int>, unsigned int);
-int tabScore(vector<vector<int>>, unsigned int);
-array<int, 2> miniMax(vector<vector<int>>&, unsigned int, int, int, unsigned int);
-array<int, 2> miniMaxParallel(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p);
+int tabScore(vector<vector<int>>&, unsigned int);
+int tabScoreScan(vector<vector<int>>, unsigned int);
+array<int, 2> miniMax(vector<vector<int>>&, unsigned int, int, int, unsigned int, SearchState* s = nullptr);
+array<int, 2> miniMaxParallel(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p, SearchState* s = nullptr);
+array<int, 2> miniMaxPVS(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p, SearchState* s = nullptr);
+array<int, 2> mtdf(vector<vector<int>>& b, unsigned int d, int guess, SearchState* s);
+bool parseSearchAlgorithm(const string&, SearchAlgorithm&);
 int heurFunction(unsigned int, unsigned int, unsigned int);
+bool boardFull(vector<vector<int>>&);
+uint64_t positionKey(vector<vector<int>>&, unsigned int, bool* mirrored = nullptr);
+bool symmetricBoard(vector<vector<int>>&);
 
 unsigned int NUM_COL = 7;
 unsigned int NUM_ROW = 6;
 unsigned int PLAYER = 1;
 unsigned int AI = 2;
 unsigned int MAX_DEPTH = 4;
+// Below this depth a subtree is too small to be worth a scheduler task
+const unsigned int SPLIT_DEPTH = 3;
+SearchAlgorithm SEARCH_ALGORITHM = SEARCH_ALPHABETA;
+// Endgame database scores: larger than any tabScore, faster wins score higher
+const int ENDGAME_WIN = 10000000;
 
 bool gameOver = false;
 unsigned int turns = 0;
@@ -37,13 +159,77 @@ unsigned int currentPlayer = PLAYER;
 
 vector<vector<int>> board(NUM_ROW, vector<int>(NUM_COL));
 
+// Pondering: while userMove() waits on input a background thread keeps
+// searching, so the game's transposition table is warm, or the reply already
+// known, by the time the move arrives.
+bool PONDER = false;
+TranspositionTable* gameTT = nullptr;
+unique_ptr<SearchState> ponderState;
+thread ponderThread;
+int ponderPrediction = -1;
+array<int, 2> ponderResult = {0, -1};
+int ponderedMove = -1;
+
+// The user's reply the last search expected, or -1
+int predictReply() {
+    int score, move, flag;
+    unsigned int depth;
+    bool mirrored;
+    if (gameTT == nullptr || !gameTT->probe(positionKey(board, PLAYER, &mirrored), score, move, depth, flag)) {
+        return -1;
+    }
+    if (mirrored && move >= 0) {
+        move = NUM_COL - 1 - move;
+    }
+    return (move >= 0 && (unsigned int)move < NUM_COL && board[NUM_ROW - 1][move] == 0) ? move : -1;
+}
+
+// Searches the position after the predicted reply to full depth, or without
+// a prediction the user's own position one ply deeper, which leaves entries
+// for every reply in the table.
+void startPondering() {
+    ponderState.reset(new SearchState());
+    ponderState->tt = gameTT;
+    ponderPrediction = predictReply();
+    ponderResult = {0, -1};
+    vector<vector<int>> position = copyBoard(board);
+    if (ponderPrediction != -1) {
+        makeMove(position, ponderPrediction, PLAYER);
+    }
+    ponderThread = thread([position]() mutable {
+        SearchState* s = ponderState.get();
+        unsigned int maxDepth = (ponderPrediction != -1) ? MAX_DEPTH : MAX_DEPTH + 1;
+        for (unsigned int d = 1; d <= maxDepth; d++) {
+            array<int, 2> result = miniMaxParallel(position, d, 0 - INT_MAX, INT_MAX,
+                                                   (ponderPrediction != -1) ? AI : PLAYER, s);
+            if (s->stop.load()) {
+                return;
+            }
+            if (ponderPrediction != -1 && d == maxDepth) {
+                ponderResult = result;
+            }
+        }
+    });
+}
+
+// Stops the background search. Returns the AI reply if the user played the
+// predicted move and its search had finished, otherwise -1.
+int stopPondering(int move) {
+    ponderState->stop.store(true);
+    ponderThread.join();
+    return (move == ponderPrediction) ? ponderResult[1] : -1;
+}
+
 void playGame() {
     printBoard(board);
     while (!gameOver) {
         if (currentPlayer == AI) {
             makeMove(board, aiMove(), AI);
         } else if (currentPlayer == PLAYER) {
-            makeMove(board, userMove(), PLAYER);
+            if (PONDER) { startPondering(); }
+            int move = userMove();
+            if (PONDER) { ponderedMove = stopPondering(move); }
+            makeMove(board, move, PLAYER);
         } else if (turns == NUM_ROW * NUM_COL) {
             gameOver = true;
         }
@@ -94,48 +280,155 @@ int userMove() {
 }
 
 int aiMove() {
+    if (ponderedMove != -1) {
+        int move = ponderedMove;
+        ponderedMove = -1;
+        std::cout << "AI already worked out this move while you were thinking." << std::endl;
+        return move;
+    }
+    ForcedMove forced = forcedMove(bitBoardFromRows(board, AI));
+    if (forced.move != -1) {
+        std::cout << "AI plays a forced move." << std::endl;
+        return forced.move;
+    }
     std::cout << "AI is thinking about a move..." << std::endl;
-    int move = miniMaxParallel(board, MAX_DEPTH, 0 - INT_MAX, INT_MAX, AI)[1];
+    SearchState s;
+    s.tt = gameTT;
+    array<int, 2> result;
+    if (SEARCH_ALGORITHM == SEARCH_MTDF) {
+        // Iterative deepening, each depth's value is the next one's first guess
+        result = {0, -1};
+        for (unsigned int d = 1; d <= MAX_DEPTH; d++) {
+            result = mtdf(board, d, result[0], &s);
+        }
+    } else if (SEARCH_ALGORITHM == SEARCH_PVS) {
+        result = miniMaxPVS(board, MAX_DEPTH, 0 - INT_MAX, INT_MAX, AI, gameTT ? &s : nullptr);
+    } else {
+        result = miniMaxParallel(board, MAX_DEPTH, 0 - INT_MAX, INT_MAX, AI, gameTT ? &s : nullptr);
+    }
+    int move = result[1];
+    if (move != -1) {
+        analysisCache.storeSearch(bitBoardFromRows(board, AI), MAX_DEPTH, result[0], move);
+    }
 
     return move;
 }
 
 
+// Looks the position up in s->tt. Returns true when the stored bound alone
+// settles the node; otherwise narrows alf/bet and reports the stored move.
+// mirrored says the key is that of the mirror image, whose moves are flipped.
+bool ttProbe(SearchState* s, uint64_t key, bool mirrored, unsigned int d, int& alf, int& bet, array<int, 2>& result) {
+    int score, move, flag;
+    unsigned int depth;
+    if (!s->tt->probe(key, score, move, depth, flag) || depth < d) {
+        return false;
+    }
+    if (mirrored && move >= 0) {
+        move = NUM_COL - 1 - move;
+    }
+    result = {score, move};
+    if (flag == TT_EXACT) { return true; }
+    if (flag == TT_LOWER) { alf = max(alf, score); }
+    if (flag == TT_UPPER) { bet = min(bet, score); }
+    return alf >= bet;
+}
+
+void ttStore(SearchState* s, uint64_t key, bool mirrored, unsigned int d, int alf, int bet, array<int, 2>& result) {
+    if (s->stop.load(memory_order_relaxed) || result[1] == -1) {
+        return;
+    }
+    int flag = TT_EXACT;
+    if (result[0] <= alf) { flag = TT_UPPER; }
+    else if (result[0] >= bet) { flag = TT_LOWER; }
+    s->tt->store(key, result[0], (mirrored && result[1] >= 0) ? NUM_COL - 1 - result[1] : result[1], d, flag);
+}
+
+// Exact {score, move} for AI when the endgame database covers b with p to move
+bool endgameScore(vector<vector<int>>& b, unsigned int p, array<int, 2>& result) {
+    EndgameEntry e;
+    if (!endgameDB.loaded() || !endgameDB.probe(bitBoardFromRows(b, p), e)) {
+        return false;
+    }
+    int score = (e.result == 0) ? 0 : e.result * (ENDGAME_WIN - e.distance);
+    result = {(p == AI) ? score : -score, e.move};
+    return true;
+}
+
+// {score, move} for AI from the persistent analysis cache when it holds a
+// search of b with p to move at least d deep
+bool cachedScore(vector<vector<int>>& b, unsigned int p, unsigned int d, array<int, 2>& result) {
+    CacheRecord r;
+    if (!analysisCache.loaded() || !analysisCache.probe(bitBoardFromRows(b, p), r) || r.depth < d) {
+        return false;
+    }
+    result = {(p == AI) ? r.score : -r.score, r.move};
+    return true;
+}
+
 // d = current depth
+// s = optional search state (transposition table, node count, deadline)
 // array<> = {score,move}
-array<int, 2> miniMax(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p) {
-    if (d == 0 || d >= (NUM_COL * NUM_ROW) - turns) {
+array<int, 2> miniMax(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p, SearchState* s) {
+    if (s) {
+        s->nodes.fetch_add(1, memory_order_relaxed);
+        if (s->stopped()) {
+            return array<int, 2>{0, -1};
+        }
+    }
+    array<int, 2> exact;
+    if (endgameScore(b, p, exact)) {
+        return exact;
+    }
+    if (d == 0 || boardFull(b)) {
         return array<int, 2>{tabScore(b, AI), -1};
     }
+    uint64_t key = 0;
+    bool mirrored = false;
+    int alfOrig = alf, betOrig = bet;
+    if (s && s->tt) {
+        array<int, 2> stored;
+        key = positionKey(b, p, &mirrored);
+        if (ttProbe(s, key, mirrored, d, alf, bet, stored)) {
+            return stored;
+        }
+    }
+    if (cachedScore(b, p, d, exact)) {
+        return exact;
+    }
+    // In a symmetric position a column and its mirror are equivalent, search one of them
+    unsigned int lastCol = symmetricBoard(b) ? (NUM_COL - 1) / 2 : NUM_COL - 1;
+    array<int, 2> moveSoFar;
     if (p == AI) {
-        array<int, 2> moveSoFar = {INT_MIN, -1};
+        moveSoFar = {INT_MIN, -1};
         if (winningMove(b, PLAYER)) {
             return moveSoFar;
         }
 
-        #pragma omp parallel for shared(b, d, alf, bet, moveSoFar) num_threads(6)
-        for (int c = 0; c < NUM_COL; c++) {
+        for (int c = 0; c <= (int)lastCol; c++) {
             if (b[NUM_ROW - 1][c] == 0) {
                 vector<vector<int>> newBoard = copyBoard(b);
                 makeMove(newBoard, c, p);
-                int score = miniMax(newBoard, d - 1, alf, bet, PLAYER)[0];
+                int score = miniMax(newBoard, d - 1, alf, bet, PLAYER, s)[0];
                 if (score > moveSoFar[0]) {
                     moveSoFar = {score, c};
                 }
                 alf = max(alf, moveSoFar[0]);
+                if (alf >= bet) {
+                    break;
+                }
             }
         }
-        return moveSoFar;
     } else {
-        array<int, 2> moveSoFar = {INT_MAX, -1};
+        moveSoFar = {INT_MAX, -1};
         if (winningMove(b, AI)) {
             return moveSoFar;
         }
-        for (unsigned int c = 0; c < NUM_COL; c++) {
+        for (unsigned int c = 0; c <= lastCol; c++) {
             if (b[NUM_ROW - 1][c] == 0) {
                 vector<vector<int>> newBoard = copyBoard(b);
                 makeMove(newBoard, c, p);
-                int score = miniMax(newBoard, d - 1, alf, bet, AI)[0];
+                int score = miniMax(newBoard, d - 1, alf, bet, AI, s)[0];
                 if (score < moveSoFar[0]) {
                     moveSoFar = {score, (int)c};
                 }
@@ -145,35 +438,76 @@ array<int, 2> miniMax(vector<vector<int>>& b, unsigned int d, int alf, int bet,
                 }
             }
         }
-        return moveSoFar;
     }
+    if (s && s->tt) {
+        ttStore(s, key, mirrored, d, alfOrig, betOrig, moveSoFar);
+    }
+    return moveSoFar;
 }
 
-array<int, 2> miniMaxParallel(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p) {
-    if (d == 0 || d >= (NUM_COL * NUM_ROW) - turns) {
+array<int, 2> miniMaxParallel(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p, SearchState* s) {
+    if (s) {
+        s->nodes.fetch_add(1, memory_order_relaxed);
+        if (s->stopped()) {
+            return array<int, 2>{0, -1};
+        }
+    }
+    array<int, 2> exact;
+    if (endgameScore(b, p, exact)) {
+        return exact;
+    }
+    if (d == 0 || boardFull(b)) {
         return array<int, 2>{tabScore(b, AI), -1};
     }
+    uint64_t key = 0;
+    bool mirrored = false;
+    int alfOrig = alf, betOrig = bet;
+    bool shared = s == nullptr || !s->deterministic;
+    if (shared && s && s->tt) {
+        array<int, 2> stored;
+        key = positionKey(b, p, &mirrored);
+        if (ttProbe(s, key, mirrored, d, alf, bet, stored)) {
+            return stored;
+        }
+    }
+    if (shared && cachedScore(b, p, d, exact)) {
+        return exact;
+    }
 
+    // In a symmetric position a column and its mirror are equivalent, search one of them
+    unsigned int lastCol = symmetricBoard(b) ? (NUM_COL - 1) / 2 : NUM_COL - 1;
+    array<int, 2> moveSoFar;
     if (p == AI) {
-        array<int, 2> moveSoFar = {INT_MIN, -1};
+        moveSoFar = {INT_MIN, -1};
         if (winningMove(b, PLAYER)) {
             return moveSoFar;
         }
 
         array<int, 2> localMoves[NUM_COL];
 
-        // Parallelize the evaluation of each subtree
-        #pragma omp parallel for shared(b, d, alf, bet, localMoves) num_threads(6)
-        for (int c = 0; c < NUM_COL; c++) {
+        // Evaluate each subtree as a scheduler task, then merge
+        TaskGroup group;
+        for (int c = 0; c <= (int)lastCol; c++) {
             if (b[NUM_ROW - 1][c] == 0) {
-                vector<vector<int>> newBoard = copyBoard(b);
-                makeMove(newBoard, c, p);
-                localMoves[c] = miniMaxParallel(newBoard, d - 1, alf, bet, PLAYER);
+                auto subtree = [&b, &localMoves, c, d, alf, bet, p, s]() {
+                    vector<vector<int>> newBoard = copyBoard(b);
+                    makeMove(newBoard, c, p);
+                    localMoves[c] = miniMaxParallel(newBoard, d - 1, alf, bet, PLAYER, s);
+                };
+                if (d >= SPLIT_DEPTH) {
+                    searchScheduler().spawn(group, subtree);
+                } else {
+                    subtree();
+                }
             }
         }
+        searchScheduler().wait(group);
 
         // Merge results from each subtree
-        for (int c = 0; c < NUM_COL; c++) {
+        for (int c = 0; c <= (int)lastCol; c++) {
+            if (b[NUM_ROW - 1][c] != 0) {
+                continue; // Full column, localMoves[c] was never written
+            }
             if (localMoves[c][0] > moveSoFar[0]) {
                 moveSoFar = {localMoves[c][0], c};
             }
@@ -182,28 +516,37 @@ array<int, 2> miniMaxParallel(vector<vector<int>>& b, unsigned int d, int alf, i
                 break;
             }
         }
-
-        return moveSoFar;
     } else {
-        array<int, 2> moveSoFar = {INT_MAX, -1};
+        moveSoFar = {INT_MAX, -1};
         if (winningMove(b, AI)) {
             return moveSoFar;
         }
 
         array<int, 2> localMoves[NUM_COL];
 
-        // Parallelize the evaluation of each subtree
-        #pragma omp parallel for shared(b, d, alf, bet, localMoves) num_threads(6)
-        for (int c = 0; c < NUM_COL; c++) {
+        // Evaluate each subtree as a scheduler task, then merge
+        TaskGroup group;
+        for (int c = 0; c <= (int)lastCol; c++) {
             if (b[NUM_ROW - 1][c] == 0) {
-                vector<vector<int>> newBoard = copyBoard(b);
-                makeMove(newBoard, c, p);
-                localMoves[c] = miniMaxParallel(newBoard, d - 1, alf, bet, AI);
+                auto subtree = [&b, &localMoves, c, d, alf, bet, p, s]() {
+                    vector<vector<int>> newBoard = copyBoard(b);
+                    makeMove(newBoard, c, p);
+                    localMoves[c] = miniMaxParallel(newBoard, d - 1, alf, bet, AI, s);
+                };
+                if (d >= SPLIT_DEPTH) {
+                    searchScheduler().spawn(group, subtree);
+                } else {
+                    subtree();
+                }
             }
         }
+        searchScheduler().wait(group);
 
         // Merge results from each subtree
-        for (int c = 0; c < NUM_COL; c++) {
+        for (int c = 0; c <= (int)lastCol; c++) {
+            if (b[NUM_ROW - 1][c] != 0) {
+                continue; // Full column, localMoves[c] was never written
+            }
             if (localMoves[c][0] < moveSoFar[0]) {
                 moveSoFar = {localMoves[c][0], c};
             }
@@ -212,20 +555,172 @@ array<int, 2> miniMaxParallel(vector<vector<int>>& b, unsigned int d, int alf, i
                 break;
             }
         }
+    }
+    if (shared && s && s->tt) {
+        ttStore(s, key, mirrored, d, alfOrig, betOrig, moveSoFar);
+    }
+    return moveSoFar;
+}
 
+
+// Principal variation search. The first child, the stored best move or else
+// the most central column, gets the full window; the others a null window
+// that only proves them no better, and a full re-search when that fails.
+// Sequential, as the null windows depend on the first child's score.
+array<int, 2> miniMaxPVS(vector<vector<int>>& b, unsigned int d, int alf, int bet, unsigned int p, SearchState* s) {
+    if (s) {
+        s->nodes.fetch_add(1, memory_order_relaxed);
+        if (s->stopped()) {
+            return array<int, 2>{0, -1};
+        }
+    }
+    array<int, 2> exact;
+    if (endgameScore(b, p, exact)) {
+        return exact;
+    }
+    if (d == 0 || boardFull(b)) {
+        return array<int, 2>{tabScore(b, AI), -1};
+    }
+    uint64_t key = 0;
+    bool mirrored = false;
+    int alfOrig = alf, betOrig = bet;
+    int hashMove = -1;
+    if (s && s->tt) {
+        array<int, 2> stored = {0, -1};
+        key = positionKey(b, p, &mirrored);
+        if (ttProbe(s, key, mirrored, d, alf, bet, stored)) {
+            return stored;
+        }
+        hashMove = stored[1];
+    }
+    if (cachedScore(b, p, d, exact)) {
+        return exact;
+    }
+    array<int, 2> moveSoFar = {(p == AI) ? INT_MIN : INT_MAX, -1};
+    if (winningMove(b, (p == AI) ? PLAYER : AI)) {
         return moveSoFar;
     }
+
+    // Stored move first, then from the centre outwards
+    unsigned int lastCol = symmetricBoard(b) ? (NUM_COL - 1) / 2 : NUM_COL - 1;
+    vector<int> order;
+    if (hashMove >= 0 && (unsigned int)hashMove <= lastCol && b[NUM_ROW - 1][hashMove] == 0) {
+        order.push_back(hashMove);
+    }
+    for (unsigned int i = 0; i < NUM_COL; i++) {
+        int c = NUM_COL / 2 + ((i % 2) ? -(int)(i + 1) / 2 : (int)(i + 1) / 2);
+        if ((unsigned int)c <= lastCol && c != hashMove && b[NUM_ROW - 1][c] == 0) {
+            order.push_back(c);
+        }
+    }
+
+    unsigned int next = (p == AI) ? PLAYER : AI;
+    for (size_t i = 0; i < order.size() && alf < bet; i++) {
+        vector<vector<int>> newBoard = copyBoard(b);
+        makeMove(newBoard, order[i], p);
+        int score;
+        if (i == 0) {
+            score = miniMaxPVS(newBoard, d - 1, alf, bet, next, s)[0];
+        } else if (p == AI) {
+            score = miniMaxPVS(newBoard, d - 1, alf, alf + 1, next, s)[0];
+            if (score > alf && score < bet) {
+                score = miniMaxPVS(newBoard, d - 1, alf, bet, next, s)[0];
+            }
+        } else {
+            score = miniMaxPVS(newBoard, d - 1, bet - 1, bet, next, s)[0];
+            if (score < bet && score > alf) {
+                score = miniMaxPVS(newBoard, d - 1, alf, bet, next, s)[0];
+            }
+        }
+        if (p == AI && score > moveSoFar[0]) {
+            moveSoFar = {score, order[i]};
+            alf = max(alf, score);
+        } else if (p != AI && score < moveSoFar[0]) {
+            moveSoFar = {score, order[i]};
+            bet = min(bet, score);
+        }
+    }
+    if (s && s->tt) {
+        ttStore(s, key, mirrored, d, alfOrig, betOrig, moveSoFar);
+    }
+    return moveSoFar;
 }
 
+// MTD(f): narrows in on the value of b for AI with null-window PVS searches
+// starting from guess. Every pass re-visits the tree, so s->tt is required.
+array<int, 2> mtdf(vector<vector<int>>& b, unsigned int d, int guess, SearchState* s) {
+    array<int, 2> result = {guess, -1};
+    int lower = INT_MIN, upper = INT_MAX;
+    while (lower < upper) {
+        int beta = (result[0] == lower) ? result[0] + 1 : result[0];
+        array<int, 2> bound = miniMaxPVS(b, d, beta - 1, beta, AI, s);
+        if (s->stop.load()) {
+            break;
+        }
+        // A fail high proves its move; a fail low only bounds them all
+        if (bound[0] >= beta || result[1] == -1) {
+            result[1] = bound[1];
+        }
+        result[0] = bound[0];
+        if (bound[0] < beta) {
+            upper = bound[0];
+        } else {
+            lower = bound[0];
+        }
+    }
+    return result;
+}
 
+bool parseSearchAlgorithm(const string& name, SearchAlgorithm& algorithm) {
+    if (name == "ab") { algorithm = SEARCH_ALPHABETA; }
+    else if (name == "pvs") { algorithm = SEARCH_PVS; }
+    else if (name == "mtdf") { algorithm = SEARCH_MTDF; }
+    else { return false; }
+    return true;
+}
+
+// heurFunction for every split of a window, as consumed by the board kernels
+WindowScores heurScores = [] {
+    WindowScores scores = {};
+    for (unsigned int g = 0; g <= 4; g++) {
+        for (unsigned int b = 0; g + b <= 4; b++) {
+            scores[g][b] = heurFunction(g, b, 4 - g - b);
+        }
+    }
+    return scores;
+}();
+
+template <int W, int H>
+int tabScoreFixed(vector<vector<int>>& b, unsigned int p) {
+    typename BasicBitBoard<W, H>::Bits own, occupied;
+    BasicBitBoard<W, H>::fromRows(b, p, own, occupied);
+    return BasicBitBoard<W, H>::scoreWindows(own, occupied ^ own, heurScores);
+}
+
+template <int W, int H>
+bool winningMoveFixed(vector<vector<int>>& b, unsigned int p) {
+    typename BasicBitBoard<W, H>::Bits own, occupied;
+    BasicBitBoard<W, H>::fromRows(b, p, own, occupied);
+    return BasicBitBoard<W, H>::alignment(own);
+}
+
+// The 7x6 board goes to the compiled kernels, any other size to the scans
+int tabScore(vector<vector<int>>& b, unsigned int p) {
+    if (NUM_COL == 7 && NUM_ROW == 6) { return tabScoreFixed<7, 6>(b, p); }
+    return tabScoreScan(b, p);
+}
 
-int tabScore(vector<vector<int>> b, unsigned int p) {
+bool winningMove(vector<vector<int>>& b, unsigned int p) {
+    if (NUM_COL == 7 && NUM_ROW == 6) { return winningMoveFixed<7, 6>(b, p); }
+    return winningMoveScan(b, p);
+}
+
+int tabScoreScan(vector<vector<int>> b, unsigned int p) {
     int score = 0;
     vector<unsigned int> rs(NUM_COL);
     vector<unsigned int> cs(NUM_ROW);
     vector<unsigned int> set(4);
     
-    #pragma omp parallel for shared(b, p, rs, score) schedule(dynamic)
     for (unsigned int r = 0; r < NUM_ROW; r++) {
         for (unsigned int c = 0; c < NUM_COL; c++) {
             rs[c] = b[r][c];
@@ -238,7 +733,6 @@ int tabScore(vector<vector<int>> b, unsigned int p) {
         }
     }
     
-    #pragma omp parallel for shared(b, p, cs, score) schedule(dynamic)
     for (unsigned int c = 0; c < NUM_COL; c++) {
         for (unsigned int r = 0; r < NUM_ROW; r++) {
             cs[r] = b[r][c];
@@ -302,11 +796,10 @@ int heurFunction(unsigned int g, unsigned int b, unsigned int z) {
     return score;
 }
 
-bool winningMove(vector<vector<int>>& b, unsigned int p) {
+bool winningMoveScan(vector<vector<int>>& b, unsigned int p) {
     unsigned int winSequence = 0;
 
     // Horizontal Check
-    #pragma omp parallel for shared(b, p) reduction(+:winSequence)
     for (unsigned int r = 0; r < NUM_ROW; r++) {
         for (unsigned int c = 0; c < NUM_COL - 3; c++) {
             unsigned int localWinSequence = 0;
@@ -322,7 +815,6 @@ bool winningMove(vector<vector<int>>& b, unsigned int p) {
     }
 
     // Vertical Check
-    #pragma omp parallel for shared(b, p) reduction(+:winSequence)
     for (unsigned int c = 0; c < NUM_COL; c++) {
         for (unsigned int r = 0; r < NUM_ROW - 3; r++) {
             unsigned int localWinSequence = 0;
@@ -338,7 +830,6 @@ bool winningMove(vector<vector<int>>& b, unsigned int p) {
     }
 
     // Diagonal (from bottom-left to top-right)
-    #pragma omp parallel for shared(b, p) reduction(+:winSequence)
     for (unsigned int r = 0; r < NUM_ROW - 3; r++) {
         for (unsigned int c = 0; c < NUM_COL - 3; c++) {
             unsigned int localWinSequence = 0;
@@ -354,7 +845,6 @@ bool winningMove(vector<vector<int>>& b, unsigned int p) {
     }
 
     // Diagonal (from top-left to bottom-right)
-    #pragma omp parallel for shared(b, p) reduction(+:winSequence)
     for (unsigned int r = 3; r < NUM_ROW; r++) {
         for (unsigned int c = 0; c < NUM_COL - 3; c++) {
             unsigned int localWinSequence = 0;
@@ -373,6 +863,46 @@ bool winningMove(vector<vector<int>>& b, unsigned int p) {
 }
 
 
+bool boardFull(vector<vector<int>>& b) {
+    for (unsigned int c = 0; c < NUM_COL; c++) {
+        if (b[NUM_ROW - 1][c] == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Encodes every column as its stones (1 = AI) topped by a sentinel bit, so
+// the key is exact for boards where NUM_COL * (NUM_ROW + 1) fits in 63 bits.
+// The key is the smaller of the board's and its mirror image's encoding;
+// mirrored reports when it is the mirror image's.
+uint64_t positionKey(vector<vector<int>>& b, unsigned int p, bool* mirrored) {
+    uint64_t key = 0, mirror = 0;
+    for (unsigned int c = 0; c < NUM_COL; c++) {
+        uint64_t col = 1;
+        for (unsigned int r = 0; r < NUM_ROW && b[r][c] != 0; r++) {
+            col = (col << 1) | ((unsigned int)b[r][c] == AI ? 1 : 0);
+        }
+        key = (key << (NUM_ROW + 1)) | col;
+        mirror |= col << (c * (NUM_ROW + 1));
+    }
+    if (mirrored) {
+        *mirrored = mirror < key;
+    }
+    return (min(key, mirror) << 1) | (p == AI ? 1 : 0);
+}
+
+bool symmetricBoard(vector<vector<int>>& b) {
+    for (unsigned int r = 0; r < NUM_ROW; r++) {
+        for (unsigned int c = 0; c < NUM_COL / 2; c++) {
+            if (b[r][c] != b[r][NUM_COL - 1 - c]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 void initBoard() {
     for (unsigned int r = 0; r < NUM_ROW; r++) {
         for (unsigned int c = 0; c < NUM_COL; c++) {
@@ -425,16 +955,44 @@ void errorMessage(int t) {
     cout << endl;
 }
 
+#ifndef CONNECT4_NO_MAIN
 int main(int argc, char** argv) {
+    // Usage: min_max_connect4 [--ponder] [--search ab|pvs|mtdf] [--threads N] [--pin] [depth] [endgame-db|-] [analysis-cache]
+    // CONNECT4_THREADS and CONNECT4_PIN set the defaults of --threads and --pin.
+    vector<char*> args = {argv[0]};
+    for (int a = 1; a < argc; a++) {
+        if (string(argv[a]) == "--ponder") { PONDER = true; }
+        else if (string(argv[a]) == "--pin") { PIN_THREADS = true; }
+        else if (string(argv[a]) == "--threads" && a + 1 < argc) { SEARCH_THREADS = max(1, atoi(argv[++a])); }
+        else if (string(argv[a]) == "--search" && a + 1 < argc) {
+            if (!parseSearchAlgorithm(argv[++a], SEARCH_ALGORITHM)) {
+                cout << "Unknown search " << argv[a] << ", using alpha-beta." << endl;
+            }
+        }
+        else { args.push_back(argv[a]); }
+    }
+    argc = args.size();
+    argv = args.data();
     int i = -1; bool flag = false;
-    if (argc == 2) {
+    if (argc >= 2) {
         istringstream in(argv[1]);
         if (!(in >> i)) { flag = true; }
         if (i > (int)(NUM_ROW * NUM_COL) || i <= -1) { flag = true; }
         if (flag) { cout << "Invalid command line argument, using default depth = 5." << endl; }
         else { MAX_DEPTH = i; }
     }
+    if (argc >= 3 && string(argv[2]) != "-" && !endgameDB.open(argv[2])) {
+        cout << "Could not load endgame database " << argv[2] << ", searching without it." << endl;
+    }
+    if (argc >= 4 && !analysisCache.open(argv[3])) {
+        cout << "Could not open analysis cache " << argv[3] << ", searching without it." << endl;
+    }
+    cout << describeThreads() << endl;
+    if (PONDER || SEARCH_ALGORITHM == SEARCH_MTDF) {
+        gameTT = new TranspositionTable();
+    }
     initBoard();
     playGame();
     return 0;
 }
+#endif
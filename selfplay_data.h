@@ -0,0 +1,253 @@
+// Self-play training data: one fixed-size record per position with the MCTS
+// visit counts of its search and the final result of the game.
+//
+// File layout: a SelfPlayHeader followed by SelfPlayRecords. Writers append
+// whole chunks to an O_APPEND descriptor while holding a process-wide mutex
+// and an flock() on the file, so any number of threads or processes can
+// append to one file and chunks never interleave. A chunk that cannot be
+// written in full is cut back to its last whole record, and that writer
+// stops appending. Readers either memory-map the file (SelfPlayData) or
+// stream it in chunks (SelfPlayStream).
+#ifndef CONNECT4_SELFPLAY_DATA_H
+#define CONNECT4_SELFPLAY_DATA_H
+
+#include "connect4_bitboard.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+const char SELFPLAY_MAGIC[8] = {'C', '4', 'S', 'P', 'L', 'A', 'Y', '1'};
+
+struct SelfPlayHeader {
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t recordSize;
+    uint32_t reserved;
+};
+
+struct SelfPlayRecord {
+    uint64_t key;                       // BitBoard::key(), decoded by BitBoard::fromKey
+    uint16_t visits[BitBoard::WIDTH];   // root visits per column, scaled down if over 65535
+    int8_t result;                      // game result for the side to move: 1, 0 or -1
+    uint8_t ply;
+};
+
+static_assert(sizeof(SelfPlayRecord) == 24, "SelfPlayRecord is part of the file format");
+
+inline SelfPlayHeader selfPlayHeader() {
+    SelfPlayHeader header = {};
+    memcpy(header.magic, SELFPLAY_MAGIC, 8);
+    header.width = BitBoard::WIDTH;
+    header.height = BitBoard::HEIGHT;
+    header.recordSize = sizeof(SelfPlayRecord);
+    return header;
+}
+
+// Opens path for appending, writing the header to a new file and checking
+// it on an existing one. Returns -1 on failure.
+inline int openSelfPlayFile(const char* path) {
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    SelfPlayHeader expected = selfPlayHeader();
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        if (write(fd, &expected, sizeof(expected)) != (ssize_t)sizeof(expected)) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    SelfPlayHeader header;
+    FILE* f = fopen(path, "rb");
+    bool ok = f != nullptr && fread(&header, sizeof(header), 1, f) == 1 && memcmp(&header, &expected, sizeof(header)) == 0;
+    if (f != nullptr) {
+        fclose(f);
+    }
+    if (!ok) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Per-thread buffer of records, appended to the shared descriptor a chunk at a time
+class SelfPlayWriter {
+public:
+    static const size_t CHUNK_RECORDS = 4096;
+
+    explicit SelfPlayWriter(int fd) : fd(fd) { buffer.reserve(CHUNK_RECORDS); }
+    ~SelfPlayWriter() { flush(); }
+
+    void add(const SelfPlayRecord& record) {
+        buffer.push_back(record);
+        if (buffer.size() == CHUNK_RECORDS) {
+            flush();
+        }
+    }
+
+    // False once a chunk could not be written in full. The file is then
+    // cut back to the chunk's last whole record, and this writer drops
+    // everything it is given from then on.
+    bool flush() {
+        if (failed || buffer.empty()) {
+            buffer.clear();
+            return !failed;
+        }
+        const char* data = (const char*)buffer.data();
+        size_t bytes = buffer.size() * sizeof(SelfPlayRecord);
+        size_t done = 0;
+        {
+            std::lock_guard<std::mutex> guard(appendLock());
+            flock(fd, LOCK_EX);
+            struct stat st;
+            if (fstat(fd, &st) != 0) {
+                failed = true;
+            }
+            while (!failed && done < bytes) {
+                ssize_t n = write(fd, data + done, bytes - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    failed = true;
+                    if (done > 0) {
+                        done -= done % sizeof(SelfPlayRecord);
+                        if (ftruncate(fd, st.st_size + done) != 0) {
+                            done = 0;  // the torn tail stays, so none of the chunk counts
+                        }
+                    }
+                } else {
+                    done += n;
+                }
+            }
+            flock(fd, LOCK_UN);
+        }
+        written += done / sizeof(SelfPlayRecord);
+        buffer.clear();
+        return !failed;
+    }
+
+    uint64_t records() const { return written + buffer.size(); }
+
+private:
+    // Writers of one process share the descriptor, and with it the flock
+    static std::mutex& appendLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    int fd;
+    std::vector<SelfPlayRecord> buffer;
+    uint64_t written = 0;
+    bool failed = false;
+};
+
+// Whole file memory-mapped read-only
+class SelfPlayData {
+public:
+    ~SelfPlayData() { close(); }
+
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SelfPlayHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        SelfPlayHeader expected = selfPlayHeader();
+        if (map == MAP_FAILED || memcmp(map, &expected, sizeof(expected)) != 0) {
+            if (map != MAP_FAILED) munmap(map, st.st_size);
+            return false;
+        }
+        mapped = map;
+        mappedLength = st.st_size;
+        count = (st.st_size - sizeof(SelfPlayHeader)) / sizeof(SelfPlayRecord);
+        return true;
+    }
+
+    void close() {
+        if (mapped) {
+            munmap(mapped, mappedLength);
+        }
+        mapped = nullptr;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    const SelfPlayRecord& operator[](size_t i) const {
+        return ((const SelfPlayRecord*)((const char*)mapped + sizeof(SelfPlayHeader)))[i];
+    }
+
+private:
+    void* mapped = nullptr;
+    size_t mappedLength = 0;
+    size_t count = 0;
+};
+
+// Sequential reader for files too large to map, or for pipes
+class SelfPlayStream {
+public:
+    ~SelfPlayStream() { close(); }
+
+    bool open(const char* path) {
+        close();
+        file = fopen(path, "rb");
+        SelfPlayHeader header, expected = selfPlayHeader();
+        if (file == nullptr || fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(&header, &expected, sizeof(header)) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (file) {
+            fclose(file);
+        }
+        file = nullptr;
+        next = end = 0;
+    }
+
+    bool read(SelfPlayRecord& record) {
+        if (next == end) {
+            next = 0;
+            end = file ? fread(buffer, sizeof(SelfPlayRecord), CHUNK_RECORDS, file) : 0;
+            if (end == 0) {
+                return false;
+            }
+        }
+        record = buffer[next++];
+        return true;
+    }
+
+private:
+    static const size_t CHUNK_RECORDS = 4096;
+
+    FILE* file = nullptr;
+    SelfPlayRecord buffer[CHUNK_RECORDS];
+    size_t next = 0;
+    size_t end = 0;
+};
+
+#endif
@@ -0,0 +1,160 @@
+// Self-play data generator: plays MCTS against itself on every core and
+// appends each searched position, with the root visit counts and the game's
+// result, to a training file in the format of selfplay_data.h.
+//
+// Build: g++ -O2 -mavx2 -mfma -pthread selfplay_gen.cpp -o selfplay_gen
+// Run:   ./selfplay_gen --engine mcts:sims=2000 --games 10000 --out selfplay.bin
+//
+// The first --sample plies of every game are drawn in proportion to the
+// visit counts instead of taking the most visited column, so games diverge.
+#include "connect4_engines.h"
+#include "selfplay_data.h"
+
+#include <thread>
+
+struct SelfPlayConfig {
+    EngineConfig engine;
+    string spec = "mcts";
+    int games = 100;
+    unsigned int threads = max(1u, thread::hardware_concurrency());
+    int samplePlies = 8;
+    unsigned int seed = 1;
+    string outPath;
+};
+
+SelfPlayConfig selfPlay;
+int outFd = -1;
+atomic<int> nextGame{0};
+atomic<uint64_t> positions{0};
+atomic<bool> writeFailed{false};
+
+// Root visit counts of the search that chose column, mirrored into the
+// columns it skipped when the position is symmetric. A move taken straight
+// from the endgame database or the threat pre-search counts as one visit.
+void rootVisits(const EngineState& state, const std::vector<int>& board, int column, uint32_t visits[BOARD_WIDTH]) {
+    bool searched = state.root != nullptr && state.root->board == board;
+    for (int col = 0; col < BOARD_WIDTH; col++) {
+        Node* child = searched ? state.root->children[col] : nullptr;
+        visits[col] = (child != nullptr) ? child->visit_count : 0;
+    }
+    if (!searched) {
+        visits[column] = 1;
+    } else if (lastDistinctColumn(board) < BOARD_WIDTH - 1) {
+        for (int col = 0; col < BOARD_WIDTH / 2; col++) {
+            visits[BOARD_WIDTH - 1 - col] = visits[col];
+        }
+    }
+}
+
+// Plays game g, adding a record per searched position
+void playGame(int g, SelfPlayWriter& writer) {
+    mt19937 rng(selfPlay.seed + g);
+    EngineState state;
+    string moves = "-";
+    std::vector<int> board;
+    int toMove;
+    bool finished;
+    replayMoves(moves, board, toMove, finished);
+    std::vector<SelfPlayRecord> game;
+    int winner = EMPTY;
+    while (!finished) {
+        EngineResult result = engineSearch(selfPlay.engine, state, moves);
+        uint32_t visits[BOARD_WIDTH];
+        rootVisits(state, board, result.column, visits);
+        uint32_t most = *max_element(visits, visits + BOARD_WIDTH);
+        SelfPlayRecord record = {};
+        record.key = bitBoardFromCells(board, toMove).key();
+        for (int col = 0; col < BOARD_WIDTH; col++) {
+            record.visits[col] = (uint16_t)(most > 65535 ? (uint64_t)visits[col] * 65535 / most : visits[col]);
+        }
+        record.ply = (uint8_t)(moves == "-" ? 0 : moves.size());
+        game.push_back(record);
+
+        int column = result.column;
+        uint32_t total = 0;
+        for (int col = 0; col < BOARD_WIDTH; col++) total += visits[col];
+        if ((int)record.ply < selfPlay.samplePlies && total > 0) {
+            uint32_t pick = rng() % total;
+            for (column = 0; pick >= visits[column]; column++) {
+                pick -= visits[column];
+            }
+        }
+        moves = (moves == "-" ? "" : moves) + (char)('0' + column);
+        int mover = toMove;
+        replayMoves(moves, board, toMove, finished);
+        if (checkWin(board, mover)) {
+            winner = mover;
+        }
+    }
+    // Records alternate sides to move, starting with PLAYER1
+    for (size_t i = 0; i < game.size(); i++) {
+        int side = (i % 2 == 0) ? PLAYER1 : PLAYER2;
+        game[i].result = (winner == EMPTY) ? 0 : (winner == side) ? 1 : -1;
+        writer.add(game[i]);
+    }
+    positions += game.size();
+}
+
+void worker() {
+    SelfPlayWriter writer(outFd);
+    int g;
+    while ((g = nextGame++) < selfPlay.games) {
+        playGame(g, writer);
+    }
+    if (!writer.flush()) {
+        writeFailed = true;
+    }
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        istringstream value(argv[i + 1]);
+        if (flag == "--engine") { value >> selfPlay.spec; }
+        else if (flag == "--games") { value >> selfPlay.games; }
+        else if (flag == "--threads") { value >> selfPlay.threads; }
+        else if (flag == "--sample") { value >> selfPlay.samplePlies; }
+        else if (flag == "--seed") { value >> selfPlay.seed; }
+        else if (flag == "--out") { value >> selfPlay.outPath; }
+        else if (flag == "--endgame") {
+            if (!endgameDB.open(argv[i + 1])) { cout << "Could not load endgame database " << argv[i + 1] << endl; return 1; }
+        }
+        else if (flag == "--value-net") {
+            if (!valueNet.load(argv[i + 1])) { cout << "Could not load value net " << argv[i + 1] << endl; return 1; }
+        }
+        else { cout << "Unknown option " << flag << endl; return 1; }
+    }
+    if (!parseEngineConfig(selfPlay.spec, selfPlay.engine) || isMinimax(selfPlay.engine) ||
+        selfPlay.games <= 0 || selfPlay.outPath.empty()) {
+        cout << "Usage: " << argv[0] << " --out FILE [--engine MCTS-SPEC] [--games N] [--threads N] [--sample PLIES]"
+             << " [--seed S] [--endgame FILE] [--value-net FILE]" << endl;
+        return 1;
+    }
+    outFd = openSelfPlayFile(selfPlay.outPath.c_str());
+    if (outFd < 0) {
+        cout << "Could not open " << selfPlay.outPath << " for appending" << endl;
+        return 1;
+    }
+    selfPlay.threads = max(1u, selfPlay.threads);
+    // Games are the unit of parallelism, one search per thread
+    if (selfPlay.threads > 1) {
+        SEARCH_THREADS = 1;
+    }
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned int i = 0; i < selfPlay.threads; i++) {
+        workers.emplace_back(worker);
+    }
+    for (thread& t : workers) {
+        t.join();
+    }
+    close(outFd);
+    if (writeFailed) {
+        cout << "Could not write every record to " << selfPlay.outPath << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Wrote " << positions << " positions from " << selfPlay.games << " games in " << fixed << setprecision(1)
+         << seconds << " s (" << setprecision(0) << (seconds > 0 ? positions / seconds : 0) << " positions/s)" << endl;
+    return 0;
+}
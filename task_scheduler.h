@@ -0,0 +1,346 @@
+// Work-stealing task scheduler shared by both engines. Every worker thread
+// owns a deque: it pushes and pops its own tasks at the back, while idle
+// workers steal the oldest (largest) tasks from the front of the others'.
+// Tasks spawned by threads outside the pool go to a shared injection deque.
+//
+// Joining is by helping: wait(group) keeps running queued tasks, its own
+// group's or anyone else's, until the group's count reaches zero. A join
+// never blocks a thread, so a recursive search can spawn subtree tasks at
+// every level instead of starting a thread team per node.
+//
+// The thread count defaults to the physical cores the process may run on.
+// Pinned workers fill the cores of one NUMA node before the next, and steal
+// from workers of their own node first, so a search spills across sockets
+// only when it needs more cores than one node has. Memory a worker touches
+// first is placed on its node by the kernel, which is how the search tree's
+// nodes and the shards of a table cleared with clearShards end up local.
+#ifndef CONNECT4_TASK_SCHEDULER_H
+#define CONNECT4_TASK_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// CPUs this process may run on, from sysfs, with the physical core and NUMA
+// node of each. Without sysfs every CPU is its own core on node 0.
+struct CpuTopology {
+    struct Cpu {
+        int id;
+        int core;     // package * 65536 + core id, the same for SMT siblings
+        int node;
+        int sibling;  // 0 for the first CPU of its core, 1 for the next, ...
+    };
+    // In pinning order: the first CPU of every core, node by node, then the
+    // second of every core, and so on
+    std::vector<Cpu> cpus;
+    unsigned int cores = 0;
+    unsigned int nodes = 0;
+};
+
+inline int readSysfsInt(const std::string& path, int fallback) {
+    std::ifstream in(path);
+    int value;
+    return (in >> value) ? value : fallback;
+}
+
+inline CpuTopology detectTopology() {
+    CpuTopology topology;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        unsigned int count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < count; i++) CPU_SET(i, &allowed);
+    }
+    std::vector<int> coresSeen, nodesSeen;
+    for (int id = 0; id < CPU_SETSIZE; id++) {
+        if (!CPU_ISSET(id, &allowed)) continue;
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(id);
+        CpuTopology::Cpu cpu = {id, id, 0, 0};
+        int package = readSysfsInt(dir + "/topology/physical_package_id", -1);
+        int core = readSysfsInt(dir + "/topology/core_id", -1);
+        if (package >= 0 && core >= 0) {
+            cpu.core = package * 65536 + core;
+        }
+        if (DIR* entries = opendir(dir.c_str())) {
+            while (dirent* entry = readdir(entries)) {
+                if (std::string(entry->d_name).compare(0, 4, "node") == 0 && entry->d_name[4] >= '0' &&
+                    entry->d_name[4] <= '9') {
+                    cpu.node = atoi(entry->d_name + 4);
+                }
+            }
+            closedir(entries);
+        }
+        cpu.sibling = std::count(coresSeen.begin(), coresSeen.end(), cpu.core);
+        if (cpu.sibling == 0) topology.cores++;
+        if (std::find(nodesSeen.begin(), nodesSeen.end(), cpu.node) == nodesSeen.end()) topology.nodes++;
+        coresSeen.push_back(cpu.core);
+        nodesSeen.push_back(cpu.node);
+        topology.cpus.push_back(cpu);
+    }
+    std::sort(topology.cpus.begin(), topology.cpus.end(), [](const CpuTopology::Cpu& a, const CpuTopology::Cpu& b) {
+        return std::tie(a.sibling, a.node, a.core, a.id) < std::tie(b.sibling, b.node, b.core, b.id);
+    });
+    return topology;
+}
+
+inline const CpuTopology& cpuTopology() {
+    static const CpuTopology topology = detectTopology();
+    return topology;
+}
+
+// CONNECT4_THREADS when set, else one thread per physical core
+inline unsigned int defaultSearchThreads() {
+    const char* env = getenv("CONNECT4_THREADS");
+    if (env != nullptr && atoi(env) > 0) {
+        return atoi(env);
+    }
+    return std::max(1u, cpuTopology().cores);
+}
+
+// CONNECT4_PIN=0/1 when set, else pinned on machines with several NUMA
+// nodes, where a worker migrating to another socket leaves its memory behind
+inline bool defaultPinThreads() {
+    const char* env = getenv("CONNECT4_PIN");
+    if (env != nullptr && *env != '\0') {
+        return atoi(env) != 0;
+    }
+    return cpuTopology().nodes > 1;
+}
+
+// Threads searching one position, counting the thread that waits on the
+// search, and whether workers are pinned to CPUs. Read when the scheduler
+// is first used, so the tools parse their --threads and --pin flags, which
+// override the defaults, before anything searches or builds a table.
+inline unsigned int SEARCH_THREADS = defaultSearchThreads();
+inline bool PIN_THREADS = defaultPinThreads();
+
+// Tasks whose completion a thread waits for together
+class TaskGroup {
+public:
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class TaskScheduler;
+    std::atomic<int> pending{0};
+};
+
+class TaskScheduler {
+public:
+    // workers threads besides the ones waiting on groups; with none every
+    // task runs inline in spawn
+    TaskScheduler(unsigned int workers, bool pin) : queues(workers + 1), victims(workers + 1) {
+        // Worker i runs on the i-th CPU of the pinning order; the first is
+        // left to the thread that starts searches
+        const CpuTopology& topology = cpuTopology();
+        std::vector<int> node(workers + 1, -1);
+        for (unsigned int i = 1; pin && i <= workers && !topology.cpus.empty(); i++) {
+            node[i] = topology.cpus[i % topology.cpus.size()].node;
+        }
+        // Deques to steal from: the injection deque, then this node's, then the rest
+        for (unsigned int i = 0; i <= workers; i++) {
+            for (unsigned int k = 1; k <= workers; k++) {
+                victims[i].push_back((i + k) % (workers + 1));
+            }
+            std::stable_partition(victims[i].begin(), victims[i].end(), [&](unsigned int v) {
+                return v == 0 || node[v] == node[i];
+            });
+        }
+        for (unsigned int i = 1; i <= workers; i++) {
+            int cpu = (pin && !topology.cpus.empty()) ? topology.cpus[i % topology.cpus.size()].id : -1;
+            threads.emplace_back([this, i, cpu]() {
+                workerIndex = i;
+                if (cpu >= 0) {
+                    pinToCpu(cpu);
+                }
+                run();
+            });
+        }
+    }
+
+    ~TaskScheduler() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) {
+            t.join();
+        }
+    }
+
+    unsigned int workers() const { return threads.size(); }
+
+    void spawn(TaskGroup& group, std::function<void()> work) {
+        if (threads.empty()) {
+            work();
+            return;
+        }
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        Queue& q = queues[workerIndex];
+        {
+            std::lock_guard<std::mutex> guard(q.lock);
+            q.tasks.push_back({&group, std::move(work)});
+        }
+        queued.fetch_add(1, std::memory_order_release);
+        if (sleeping.load(std::memory_order_relaxed) > 0) {
+            wake.notify_one();
+        }
+    }
+
+    void wait(TaskGroup& group) {
+        while (!group.done()) {
+            if (!runOne()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct Task {
+        TaskGroup* group;
+        std::function<void()> work;
+    };
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    // Own deque newest first, then the others oldest first
+    bool runOne() {
+        if (queued.load(std::memory_order_acquire) <= 0) {
+            return false;
+        }
+        Task task;
+        bool found = take(queues[workerIndex], task, true);
+        for (size_t i = 0; !found && i < victims[workerIndex].size(); i++) {
+            found = take(queues[victims[workerIndex][i]], task, false);
+        }
+        if (!found) {
+            return false;
+        }
+        task.work();
+        task.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+
+    bool take(Queue& q, Task& task, bool newest) {
+        std::lock_guard<std::mutex> guard(q.lock);
+        if (q.tasks.empty()) {
+            return false;
+        }
+        if (newest) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Spins briefly when out of work, then sleeps until a spawn
+    void run() {
+        int idle = 0;
+        while (true) {
+            if (runOne()) {
+                idle = 0;
+                continue;
+            }
+            if (++idle < 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            if (stopping) {
+                return;
+            }
+            sleeping++;
+            // The timeout covers a spawn that checked sleeping just before it was raised
+            wake.wait_for(guard, std::chrono::milliseconds(1),
+                          [this]() { return stopping || queued.load(std::memory_order_acquire) > 0; });
+            sleeping--;
+            idle = 0;
+        }
+    }
+
+    static void pinToCpu(int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    // Deque of the calling thread: its own for workers, 0 (injection) otherwise
+    static inline thread_local unsigned int workerIndex = 0;
+
+    std::vector<Queue> queues;
+    std::vector<std::vector<unsigned int>> victims;  // steal order of each deque's owner
+    std::vector<std::thread> threads;
+    std::atomic<int> queued{0};
+    std::atomic<int> sleeping{0};
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+// The scheduler both engines search with, started on first use
+inline TaskScheduler& searchScheduler() {
+    static const unsigned int threads = SEARCH_THREADS;
+    static const bool pinned = PIN_THREADS;
+    static TaskScheduler scheduler(threads > 1 ? threads - 1 : 0, pinned);
+    // The pool is sized once, so settings changed after it started are
+    // reported and put back, keeping describeThreads() true to the pool
+    static std::atomic<bool> reported{false};
+    if ((SEARCH_THREADS != threads || PIN_THREADS != pinned) && !reported.exchange(true)) {
+        fprintf(stderr, "search threads already started as %u%s; ignoring %u%s set later\n", threads,
+                pinned ? " pinned" : "", SEARCH_THREADS, PIN_THREADS ? " pinned" : "");
+        SEARCH_THREADS = threads;
+        PIN_THREADS = pinned;
+    }
+    return scheduler;
+}
+
+// Runs fill(begin, end) over [0, size) in shards spread over the workers,
+// for zeroing a large table: each page is then first touched, and so
+// placed, on the node of a worker that searches it, instead of all on the
+// node of the thread that allocated it
+inline void clearShards(size_t size, const std::function<void(size_t, size_t)>& fill) {
+    const size_t shard = 1 << 16;
+    TaskScheduler& scheduler = searchScheduler();
+    if (scheduler.workers() == 0 || size <= shard) {
+        fill(0, size);
+        return;
+    }
+    TaskGroup group;
+    for (size_t begin = 0; begin < size; begin += shard) {
+        size_t end = std::min(size, begin + shard);
+        scheduler.spawn(group, [&fill, begin, end]() { fill(begin, end); });
+    }
+    scheduler.wait(group);
+}
+
+// One line on the threads a search uses and the machine they run on
+inline std::string describeThreads() {
+    const CpuTopology& topology = cpuTopology();
+    return std::to_string(SEARCH_THREADS) + " search threads" + (PIN_THREADS ? " pinned" : "") + " on " +
+           std::to_string(topology.cpus.size()) + " CPUs, " + std::to_string(topology.cores) + " cores, " +
+           std::to_string(topology.nodes) + " NUMA node" + (topology.nodes == 1 ? "" : "s");
+}
+
+#endif
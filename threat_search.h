@@ -0,0 +1,152 @@
+// Tactical pre-search run before the engines: finds wins by continuous
+// threats, must-block moves and positions lost whatever is played, on the
+// bitboard alone. It allocates nothing and searches only forcing lines, so a
+// forced position is settled in microseconds instead of by a full search.
+//
+// A win by continuous threats is a sequence in which every move of the
+// attacker either wins or leaves the defender a single move that does not
+// lose at once, until the defender has none. Wins found this way are exact;
+// wins that need a quiet move on the way are left to the engines.
+#ifndef CONNECT4_THREAT_SEARCH_H
+#define CONNECT4_THREAT_SEARCH_H
+
+#include "connect4_bitboard.h"
+
+// Attacker moves a threat search may spend, so lines of up to 2 * 8 - 1 plies
+const int THREAT_DEPTH = 8;
+
+// Result of forcedMove. result is from the side to move: 1 forced win,
+// -1 forced loss, 0 a single move that does not lose at once (a must-block)
+struct ForcedMove {
+    int move = -1;  // column to play, -1 when the position is not forced
+    int result = 0;
+    int plies = 0;  // plies to the end of the game for a forced win or loss
+};
+
+// Columns from the centre outwards, where threats are most often found
+const int THREAT_ORDER[BitBoard::WIDTH] = {3, 2, 4, 1, 5, 0, 6};
+
+// Cells where the side to move wins with its next stone
+inline BitBoard::Bits winningMoves(const BitBoard& b) {
+    return BitBoard::winningCells(b.current, b.mask) & b.possible();
+}
+
+// Cells the side to move can play without letting the opponent win on the
+// next move: the block when the opponent threatens once, nothing when it
+// threatens twice, never the cell under an opponent threat
+inline BitBoard::Bits nonLosingMoves(const BitBoard& b) {
+    BitBoard::Bits possible = b.possible();
+    BitBoard::Bits threats = BitBoard::winningCells(b.current ^ b.mask, b.mask);
+    BitBoard::Bits forced = possible & threats;
+    if (forced) {
+        if (forced & (forced - 1)) {
+            return 0;
+        }
+        possible = forced;
+    }
+    return possible & ~(threats >> 1);
+}
+
+// Plies in which the side to move of b wins by continuous threats using at
+// most `moves` of its own moves, 0 when no such win exists. column receives
+// the first move of the shortest win found.
+inline int threatWin(const BitBoard& b, int moves, int* column = nullptr) {
+    BitBoard::Bits wins = winningMoves(b);
+    if (wins) {
+        for (int col : THREAT_ORDER) {
+            if (wins & BitBoard::column(col)) {
+                if (column) *column = col;
+                return 1;
+            }
+        }
+    }
+    if (moves <= 1) {
+        return 0;
+    }
+    BitBoard::Bits candidates = nonLosingMoves(b);
+    int best = 0;
+    for (int col : THREAT_ORDER) {
+        if (!(candidates & BitBoard::column(col))) continue;
+        BitBoard attack = b;
+        attack.play(col);
+        if (attack.full()) continue;
+        BitBoard::Bits replies = nonLosingMoves(attack);
+        int plies = 0;
+        if (replies == 0) {
+            plies = 3;  // every reply lets the attacker win next move
+        } else if (!(replies & (replies - 1))) {
+            // A single reply: play it and keep attacking
+            BitBoard defence = attack;
+            for (int reply = 0; reply < BitBoard::WIDTH; reply++) {
+                if (replies & BitBoard::column(reply)) defence.play(reply);
+            }
+            int rest = defence.full() ? 0 : threatWin(defence, (best ? best / 2 : moves) - 1);
+            plies = rest ? rest + 2 : 0;
+        }
+        if (plies && (!best || plies < best)) {
+            best = plies;
+            if (column) *column = col;
+            if (best == 3) break;
+        }
+    }
+    return best;
+}
+
+// The move to play in b when the position is forced within `depth` attacker
+// moves, in the order: an immediate win, a win by continuous threats, the
+// only move that does not lose at once, and, when every move loses, the one
+// that holds out longest. move is -1 when the engines have a real choice.
+inline ForcedMove forcedMove(const BitBoard& b, int depth = THREAT_DEPTH) {
+    ForcedMove forced;
+    if (depth <= 0 || b.full()) {
+        return forced;
+    }
+    int column = -1;
+    int plies = threatWin(b, depth, &column);
+    if (plies) {
+        forced.move = column;
+        forced.result = 1;
+        forced.plies = plies;
+        return forced;
+    }
+    BitBoard::Bits candidates = nonLosingMoves(b);
+    if (candidates == 0) {
+        // Lost next move whatever is played; block a threat all the same
+        BitBoard::Bits possible = b.possible();
+        BitBoard::Bits block = possible & BitBoard::winningCells(b.current ^ b.mask, b.mask);
+        for (int col : THREAT_ORDER) {
+            if ((block ? block : possible) & BitBoard::column(col)) {
+                forced.move = col;
+                break;
+            }
+        }
+        forced.result = -1;
+        forced.plies = 2;
+        return forced;
+    }
+    // Every remaining move either survives the opponent's threats or loses
+    // to them; the longest loss is kept in case all of them do
+    int longest = 0;
+    for (int col : THREAT_ORDER) {
+        if (!(candidates & BitBoard::column(col))) continue;
+        BitBoard child = b;
+        child.play(col);
+        int loss = child.full() ? 0 : threatWin(child, depth);
+        if (loss == 0) {
+            if (candidates & (candidates - 1)) {
+                return ForcedMove();
+            }
+            forced.move = col;  // the only move, and it holds
+            return forced;
+        }
+        if (loss > longest) {
+            longest = loss;
+            forced.move = col;
+        }
+    }
+    forced.result = -1;
+    forced.plies = longest + 1;
+    return forced;
+}
+
+#endif
@@ -0,0 +1,186 @@
+// Small value network for MCTS leaves, so one evaluation can stand in for a
+// whole random playout. The inputs are the 69 windows of the 7x6 board. Each
+// window is one-hot over its (own stones, opponent stones) split as seen by
+// the side to move. A position therefore activates exactly one first-layer
+// row per window, and the first layer is the sum of 69 rows (an n-tuple
+// network). A ReLU hidden layer of HIDDEN units and a tanh output give the
+// value in [-1, 1] for the side to move.
+//
+// Inference allocates nothing and uses AVX2/FMA when compiled with
+// -mavx2 -mfma, otherwise plain loops. Weights come from a file written by
+// save(). Until one is loaded the net holds weights derived from a window
+// heuristic in the spirit of heurFunction, so it is usable untrained.
+//
+// File layout: a ValueNetHeader, then w1[ROWS][HIDDEN], b1[HIDDEN],
+// w2[HIDDEN] and b2 as little-endian floats.
+#ifndef CONNECT4_VALUE_NET_H
+#define CONNECT4_VALUE_NET_H
+
+#include "connect4_bitboard.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+const char VALUE_NET_MAGIC[8] = {'C', '4', 'V', 'N', 'E', 'T', '0', '1'};
+
+struct ValueNetHeader {
+    char magic[8];
+    uint32_t windows;
+    uint32_t hidden;
+};
+
+class ValueNet {
+public:
+    static const int WINDOWS = BitBoard::NUM_WINDOWS;
+    static const int SPLITS = 25;  // own * 5 + opponent stones in a window
+    static const int ROWS = WINDOWS * SPLITS;
+    static const int HIDDEN = 32;
+
+    alignas(32) float w1[ROWS][HIDDEN];
+    alignas(32) float b1[HIDDEN];
+    alignas(32) float w2[HIDDEN];
+    float b2;
+
+    ValueNet() { initHeuristic(); }
+
+    // First-layer row of every window for b, as seen by the side to move
+    static void features(const BitBoard& b, int rows[WINDOWS]) {
+        BitBoard::Bits own = b.current, opp = b.current ^ b.mask;
+        #pragma GCC unroll 128
+        for (int i = 0; i < WINDOWS; i++) {
+            rows[i] = i * SPLITS + popcount(own & BitBoard::WINDOWS.all[i]) * 5 + popcount(opp & BitBoard::WINDOWS.all[i]);
+        }
+    }
+
+    // Value of b for the side to move
+    float evaluate(const BitBoard& b) const {
+        int rows[WINDOWS];
+        features(b, rows);
+        return std::tanh(output(rows));
+    }
+
+    // Values of count positions, for evaluators that gather leaves in
+    // batches. Only a convenience loop over the single-position inference:
+    // the first layer is a gather of w1 rows, not a matmul, and interleaving
+    // the rows of 2 to 8 positions measured no faster than one at a time.
+    void evaluate(const BitBoard* boards, size_t count, float* values) const {
+        int rows[WINDOWS];
+        for (size_t i = 0; i < count; i++) {
+            features(boards[i], rows);
+            values[i] = std::tanh(output(rows));
+        }
+    }
+
+    // Pre-tanh output for the given feature rows
+    float output(const int rows[WINDOWS]) const {
+#ifdef __AVX2__
+        static_assert(HIDDEN % 8 == 0, "HIDDEN must be a multiple of the AVX2 width");
+        __m256 acc[HIDDEN / 8];
+        for (int k = 0; k < HIDDEN / 8; k++) {
+            acc[k] = _mm256_load_ps(b1 + 8 * k);
+        }
+        for (int i = 0; i < WINDOWS; i++) {
+            const float* row = w1[rows[i]];
+            #pragma GCC unroll 4
+            for (int k = 0; k < HIDDEN / 8; k++) {
+                acc[k] = _mm256_add_ps(acc[k], _mm256_load_ps(row + 8 * k));
+            }
+        }
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < HIDDEN / 8; k++) {
+            __m256 relu = _mm256_max_ps(acc[k], _mm256_setzero_ps());
+            sum = _mm256_fmadd_ps(relu, _mm256_load_ps(w2 + 8 * k), sum);
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        return _mm_cvtss_f32(half) + b2;
+#else
+        float hidden[HIDDEN];
+        memcpy(hidden, b1, sizeof(hidden));
+        for (int i = 0; i < WINDOWS; i++) {
+            const float* row = w1[rows[i]];
+            for (int k = 0; k < HIDDEN; k++) {
+                hidden[k] += row[k];
+            }
+        }
+        float sum = b2;
+        for (int k = 0; k < HIDDEN; k++) {
+            sum += (hidden[k] > 0 ? hidden[k] : 0) * w2[k];
+        }
+        return sum;
+#endif
+    }
+
+    bool load(const char* path) {
+        FILE* f = fopen(path, "rb");
+        if (f == nullptr) {
+            return false;
+        }
+        ValueNetHeader header;
+        bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, VALUE_NET_MAGIC, 8) == 0 &&
+                  header.windows == WINDOWS && header.hidden == HIDDEN && fread(w1, sizeof(w1), 1, f) == 1 &&
+                  fread(b1, sizeof(b1), 1, f) == 1 && fread(w2, sizeof(w2), 1, f) == 1 &&
+                  fread(&b2, sizeof(b2), 1, f) == 1;
+        fclose(f);
+        if (!ok) {
+            initHeuristic();  // never leave a half-read net behind
+        }
+        return ok;
+    }
+
+    bool save(const char* path) const {
+        FILE* f = fopen(path, "wb");
+        if (f == nullptr) {
+            return false;
+        }
+        ValueNetHeader header = {};
+        memcpy(header.magic, VALUE_NET_MAGIC, 8);
+        header.windows = WINDOWS;
+        header.hidden = HIDDEN;
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(w1, sizeof(w1), 1, f) == 1 &&
+                  fwrite(b1, sizeof(b1), 1, f) == 1 && fwrite(w2, sizeof(w2), 1, f) == 1 &&
+                  fwrite(&b2, sizeof(b2), 1, f) == 1;
+        return fclose(f) == 0 && ok;
+    }
+
+    // Window heuristic on two hidden units, one per sign, so that
+    // relu(h0) - relu(h1) is the sum of the window scores
+    void initHeuristic() {
+        memset(w1, 0, sizeof(w1));
+        memset(b1, 0, sizeof(b1));
+        memset(w2, 0, sizeof(w2));
+        b2 = 0;
+        for (int i = 0; i < WINDOWS; i++) {
+            for (int own = 0; own <= 4; own++) {
+                for (int opp = 0; own + opp <= 4; opp++) {
+                    float score = windowScore(own, opp) - windowScore(opp, own);
+                    w1[i * SPLITS + own * 5 + opp][0] = score;
+                    w1[i * SPLITS + own * 5 + opp][1] = -score;
+                }
+            }
+        }
+        w2[0] = 1;
+        w2[1] = -1;
+    }
+
+private:
+    // Score of a window holding only own stones, scaled so a typical
+    // middlegame lands well inside tanh's range
+    static float windowScore(int own, int opp) {
+        if (opp > 0) return 0;
+        if (own == 4) return 2.0f;
+        if (own == 3) return 0.08f;
+        if (own == 2) return 0.01f;
+        return 0;
+    }
+};
+
+// Process-wide net the MCTS leaf evaluator uses
+inline ValueNet valueNet;
+
+#endif